@@ -0,0 +1,547 @@
+/* ******************************************************************
+   Benchmarks for the emulator and protocol hot paths.
+
+   The emulator is compiled into this file so the benchmarks can reach
+   its event list and channel parameters directly.  Link with gbn.c or
+   sr.c to choose the protocol under test, with -DPACING=1 to pace
+   gbn.c, and with sampler.c, verify.c, traffic.c, timer.c, fec.c,
+   profile.c and eventlog.c.  Every result is written to stdout as one
+   CSV row:
+
+     benchmark,protocol,case,metric,value
+
+   Runs use fixed seeds, so the simulated work is identical between
+   versions and only the timings should move.  Naming sections (checksum,
+   queue, e2e, speed, capacity, fec, replay, soak) on the command line
+   runs only those.
+**********************************************************************/
+#define _XOPEN_SOURCE 600    /* clock_gettime, and random() for the emulator */
+#include <time.h>
+
+/* the emulator's clock is called time, which clashes with <time.h> */
+#define time emutime
+#define main emulator_main
+#include "../emulator.c"
+#undef main
+#undef time
+
+#ifndef PROTOCOL
+#define PROTOCOL "unknown"
+#endif
+
+#define E2EMESSAGES  5000    /* messages generated by each end-to-end run */
+#define E2EMAXEVENTS 1000000 /* give up on a run that does not finish */
+#define MICROOPS     200000  /* operations timed by each micro benchmark */
+#define REPLAYLOG    "bench_replay.log" /* event log the replay benchmark writes */
+#define SOAKMESSAGES 50000   /* messages generated by each soak run */
+#define SPEEDMESSAGES 1000000 /* messages generated by each speed run, about half a second */
+#define SPEEDREPEATS 3       /* timed runs of each speed case */
+
+extern int ComputeChecksum(struct pkt);
+
+static double seconds(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* processor time used by this process, which other processes on the
+   machine do not disturb */
+static double cpuseconds(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void result(const char *benchmark, const char *bcase, const char *metric, double value)
+{
+  printf("%s,%s,%s,%s,%.6g\n", benchmark, PROTOCOL, bcase, metric, value);
+}
+
+/* free every event left on the event list */
+static void clearevlist(void)
+{
+  struct event *q;
+
+  while (evlist != NULL) {
+    q = evlist;
+    evlist = evlist->next;
+    freeevent(q);
+  }
+  nevents = 0;
+  ninflight = 0;
+  nintact = 0;
+}
+
+/* fill the event list with n layer 5 arrivals at A spread over [0,1000] */
+static void fillevlist(int n)
+{
+  struct event *evptr;
+  int i;
+
+  for (i=0; i<n; i++) {
+    evptr = allocevent();
+    evptr->evtime = 1000.0 * jimsrand();
+    evptr->evtype = FROM_LAYER5;
+    evptr->eventity = A;
+    insertevent(evptr);
+  }
+}
+
+/* cost of insertevent, starttimer/stoptimer and tolayer3 as the event list grows */
+static void benchqueue(void)
+{
+  static const int lengths[] = { 16, 256, 4096 };
+  static struct timer timers[4096+1];
+  struct event *evptr;
+  struct pkt packet;
+  char bcase[64];
+  double start, elapsed;
+  int l, i, k, nops, sent;
+
+  for (l=0; l<(int)(sizeof(lengths)/sizeof(lengths[0])); l++) {
+    seedrandom(9999);
+    emutime = 0.0;
+    lossprob = 0.0;
+    corruptprob = 0.0;
+    clearevlist();
+    fillevlist(lengths[l]);
+    sprintf(bcase, "queue=%d", lengths[l]);
+    /* every operation scans the list, so do fewer of them on long lists */
+    nops = MICROOPS / (lengths[l] / 16);
+
+    /* insert an event at a random position, then unlink it again */
+    evptr = allocevent();
+    evptr->evtype = FROM_LAYER5;
+    evptr->eventity = B;
+    start = seconds();
+    for (i=0; i<nops; i++) {
+      evptr->evtime = i % 1000;
+      insertevent(evptr);
+      if (evptr->prev != NULL)
+        evptr->prev->next = evptr->next;
+      else
+        evlist = evptr->next;
+      if (evptr->next != NULL)
+        evptr->next->prev = evptr->prev;
+      nevents--;
+    }
+    elapsed = seconds() - start;
+    freeevent(evptr);
+    result("insertevent", bcase, "ns_per_op", elapsed * 1e9 / nops);
+
+    /* start and cancel the timer, both scan the event list */
+    start = seconds();
+    for (i=0; i<nops; i++) {
+      starttimer(B, 500.0);
+      stoptimer(B);
+    }
+    elapsed = seconds() - start;
+    result("starttimer_stoptimer", bcase, "ns_per_op", elapsed * 1e9 / nops);
+
+    /* the same through the timer service, with lengths[l] other timers running */
+    for (k=0; k<lengths[l]; k++)
+      settimer(&timers[k], A, 1000.0 * jimsrand(), NULL, NULL);
+    start = seconds();
+    for (i=0; i<nops; i++) {
+      settimer(&timers[lengths[l]], B, 500.0, NULL, NULL);
+      canceltimer(&timers[lengths[l]]);
+    }
+    elapsed = seconds() - start;
+    result("settimer_canceltimer", bcase, "ns_per_op", elapsed * 1e9 / nops);
+    timer_reset(emutime);
+
+    /* send packets into an idle medium, removing them in groups */
+    for (k=0; k<20; k++)
+      packet.payload[k] = 'a';
+    packet.seqnum = 0;
+    packet.acknum = 0;
+    packet.checksum = 0;
+    elapsed = 0.0;
+    sent = 0;
+    for (i=0; i<nops; i+=64) {
+      start = seconds();
+      for (k=0; k<64; k++)
+        tolayer3(A, packet);
+      elapsed += seconds() - start;
+      sent += 64;
+      clearevlist();
+      seedrandom(9999);
+      fillevlist(lengths[l]);
+    }
+    result("tolayer3", bcase, "ns_per_op", elapsed * 1e9 / sent);
+  }
+  clearevlist();
+}
+
+/* checksum throughput over packets with varying content */
+static void benchchecksum(void)
+{
+  static struct pkt packets[256];
+  volatile int sink = 0;
+  double start, elapsed;
+  int i, k;
+
+  for (i=0; i<256; i++) {
+    packets[i].seqnum = i;
+    packets[i].acknum = -1;
+    for (k=0; k<20; k++)
+      packets[i].payload[k] = 97 + (i + k) % 26;
+  }
+  start = seconds();
+  for (i=0; i<MICROOPS * 10; i++)
+    sink += ComputeChecksum(packets[i & 255]);
+  elapsed = seconds() - start;
+  result("ComputeChecksum", "payload=20", "packets_per_sec", MICROOPS * 10 / elapsed);
+  result("ComputeChecksum", "payload=20", "ns_per_op", elapsed * 1e9 / (MICROOPS * 10));
+}
+
+/* end-to-end simulation over a fixed matrix of channel settings */
+static void benche2e(void)
+{
+  static const float losses[] = { 0.0, 0.1, 0.3 };
+  static const float corrupts[] = { 0.0, 0.1 };
+  static const float lambdas[] = { 5.0, 20.0, 50.0 };
+  static const unsigned seeds[] = { 9999, 1234 };
+  char bcase[128];
+  double start, elapsed;
+  long events;
+  int l, c, m, s;
+
+  for (l=0; l<3; l++)
+    for (c=0; c<2; c++)
+      for (m=0; m<3; m++)
+        for (s=0; s<2; s++) {
+          nsimmax = E2EMESSAGES;
+          lossprob = losses[l];
+          corruptprob = corrupts[c];
+          corruptdirection = 2;
+          lambda = lambdas[m];
+          sprintf(bcase, "loss=%.1f;corrupt=%.1f;lambda=%.0f;seed=%u",
+                  losses[l], corrupts[c], lambdas[m], seeds[s]);
+
+          seedrandom(seeds[s]);
+          clearevlist();
+          resetsimulation();
+          A_init();
+          B_init();
+          verify = 1;
+          verify_init();
+
+          start = seconds();
+          events = simulate(E2EMAXEVENTS);
+          elapsed = seconds() - start;
+
+          result("e2e", bcase, "events_per_sec", events / elapsed);
+          result("e2e", bcase, "messages_per_sec", nsim / elapsed);
+          result("e2e", bcase, "delivered", messages_delivered);
+          result("e2e", bcase, "resent", packets_resent);
+          result("e2e", bcase, "sim_time", emutime);
+          result("e2e", bcase, "delay_mean", ndelays > 0 ? delaysum / ndelays : 0.0);
+          result("e2e", bcase, "delay_p50", delaypercentile(0.5));
+          result("e2e", bcase, "delay_p90", delaypercentile(0.9));
+          result("e2e", bcase, "delay_p99", delaypercentile(0.99));
+          result("e2e", bcase, "timeouts", packets_timeout);
+          result("e2e", bcase, "spurious_timeouts", nspurious);
+          result("e2e", bcase, "completed", evlist == NULL);
+          result("e2e", bcase, "verify_errors", verify_errors());
+        }
+  clearevlist();
+}
+
+/* the middle of n values, which are sorted in place */
+static double median(double *v, int n)
+{
+  double x;
+  int i, j;
+
+  for (i=1; i<n; i++) {
+    x = v[i];
+    for (j=i; j>0 && v[j-1]>x; j--)
+      v[j] = v[j-1];
+    v[j] = x;
+  }
+  return v[n/2];
+}
+
+/* simulation speed on long runs that do not congest the medium, each timed
+   SPEEDREPEATS times for the median, so that builds can be compared */
+static void benchspeed(void)
+{
+  static const float losses[] = { 0.0, 0.1, 0.3 };
+  static const float corrupts[] = { 0.0, 0.1 };
+  double eps[SPEEDREPEATS];
+  char bcase[128];
+  double start, elapsed;
+  long events;
+  int l, c, r;
+
+  for (l=0; l<3; l++)
+    for (c=0; c<2; c++) {
+      sprintf(bcase, "loss=%.1f;corrupt=%.1f;lambda=50", losses[l], corrupts[c]);
+      for (r=0; r<SPEEDREPEATS; r++) {
+        nsimmax = SPEEDMESSAGES;
+        lossprob = losses[l];
+        corruptprob = corrupts[c];
+        corruptdirection = 2;
+        lambda = 50.0;
+
+        seedrandom(9999);
+        clearevlist();
+        resetsimulation();
+        A_init();
+        B_init();
+        verify = 0;
+
+        start = cpuseconds();
+        events = simulate(0);
+        elapsed = cpuseconds() - start;
+        eps[r] = events / elapsed;
+      }
+      result("speed", bcase, "events", events);
+      result("speed", bcase, "events_per_sec", median(eps, SPEEDREPEATS));
+      result("speed", bcase, "events_per_sec_min", eps[0]);
+      result("speed", bcase, "events_per_sec_max", eps[SPEEDREPEATS-1]);
+    }
+  clearevlist();
+}
+
+/* capacity of the window: a saturating constant rate source at each loss rate */
+static void benchcapacity(void)
+{
+  static const float losses[] = { 0.0, 0.1, 0.3 };
+  char bcase[128];
+  int l;
+
+  for (l=0; l<3; l++) {
+    nsimmax = E2EMESSAGES;
+    lossprob = losses[l];
+    corruptprob = 0.0;
+    corruptdirection = 2;
+    lambda = 1.0;
+    arrivalprocess = ARRIVAL_CBR;
+    sprintf(bcase, "arrival=cbr;loss=%.1f;lambda=1", losses[l]);
+
+    seedrandom(9999);
+    clearevlist();
+    resetsimulation();
+    A_init();
+    B_init();
+    verify = 1;
+    verify_init();
+    simulate(E2EMAXEVENTS);
+
+    result("capacity", bcase, "goodput", messages_delivered / emutime);
+    result("capacity", bcase, "window_full_fraction", (double)window_full / nsim);
+    result("capacity", bcase, "delay_mean", ndelays > 0 ? delaysum / ndelays : 0.0);
+    result("capacity", bcase, "delay_p50", delaypercentile(0.5));
+    result("capacity", bcase, "delay_p90", delaypercentile(0.9));
+    result("capacity", bcase, "delay_p99", delaypercentile(0.99));
+    result("capacity", bcase, "timeouts", packets_timeout);
+    result("capacity", bcase, "spurious_timeouts", nspurious);
+    result("capacity", bcase, "completed", evlist == NULL);
+    result("capacity", bcase, "verify_errors", verify_errors());
+  }
+  arrivalprocess = ARRIVAL_UNIFORM;
+  clearevlist();
+}
+
+/* goodput and delay with and without FEC as the loss rate rises, from a
+   constant rate source fast enough to fill FEC blocks */
+static void benchfec(void)
+{
+  static const float losses[] = { 0.0, 0.1, 0.2, 0.3 };
+  static const int blocks[] = { 0, 1, 2, 4 };
+  char bcase[128];
+  int l, k;
+
+  for (l=0; l<4; l++)
+    for (k=0; k<4; k++) {
+      nsimmax = E2EMESSAGES;
+      lossprob = losses[l];
+      corruptprob = 0.0;
+      corruptdirection = 2;
+      lambda = 2.0;
+      arrivalprocess = ARRIVAL_CBR;
+      fecblock = blocks[k];
+      sprintf(bcase, "arrival=cbr;loss=%.1f;lambda=2;fec=%d", losses[l], blocks[k]);
+
+      seedrandom(9999);
+      clearevlist();
+      resetsimulation();
+      A_init();
+      B_init();
+      verify = 1;
+      verify_init();
+      simulate(E2EMAXEVENTS);
+
+      result("fec", bcase, "goodput", messages_delivered / emutime);
+      result("fec", bcase, "delay_mean", ndelays > 0 ? delaysum / ndelays : 0.0);
+      result("fec", bcase, "resent", packets_resent);
+      result("fec", bcase, "packets_sent", ntolayer3);
+      result("fec", bcase, "completed", evlist == NULL && timer_count() == 0);
+      result("fec", bcase, "verify_errors", verify_errors());
+    }
+  arrivalprocess = ARRIVAL_UNIFORM;
+  fecblock = 0;
+  clearevlist();
+}
+
+/* simulation speed against replaying the event log it recorded */
+static void benchreplay(void)
+{
+  static const float losses[] = { 0.0, 0.1, 0.3 };
+  char bcase[128];
+  double start, recorded, replayed;
+  int l, delivered;
+  long count;
+  FILE *fp;
+
+  for (l=0; l<3; l++) {
+    nsimmax = E2EMESSAGES;
+    lossprob = losses[l];
+    corruptprob = 0.1;
+    corruptdirection = 2;
+    lambda = 5.0;
+    sprintf(bcase, "loss=%.1f;corrupt=0.1;lambda=5", losses[l]);
+
+    seedrandom(9999);
+    clearevlist();
+    resetsimulation();
+    A_init();
+    B_init();
+    recordfilename = REPLAYLOG;
+    if (!eventlog_create(REPLAYLOG))
+      return;
+    start = seconds();
+    simulate(E2EMAXEVENTS);
+    eventlog_close();
+    recorded = seconds() - start;
+    recordfilename = NULL;
+    delivered = messages_delivered;
+
+    clearevlist();
+    resetsimulation();
+    A_init();
+    B_init();
+    clearevlist();
+    diverged = 0;
+    if (!eventlog_open(REPLAYLOG))
+      return;
+    start = seconds();
+    count = replay();
+    replayed = seconds() - start;
+    eventlog_close();
+
+    fp = fopen(REPLAYLOG, "rb");
+    if (fp != NULL) {
+      fseek(fp, 0, SEEK_END);
+      result("replay", bcase, "log_bytes", ftell(fp));
+      fclose(fp);
+    }
+    result("replay", bcase, "record_messages_per_sec", nsim / recorded);
+    result("replay", bcase, "replay_messages_per_sec", nsim / replayed);
+    result("replay", bcase, "replay_inputs", count);
+    result("replay", bcase, "diverged", diverged);
+    result("replay", bcase, "delivered_match", messages_delivered == delivered);
+  }
+  remove(REPLAYLOG);
+  clearevlist();
+}
+
+/* a long saturating run with and without caps on the event list and the
+   medium, from nothing allocated, for the memory each one ends up using.
+   Uncapped, GBN drops most messages for a full window and delivers the
+   ones it accepted long after they were generated, so the verifier must
+   still report no errors and nothing missing.  The smallest event cap is
+   below what the event list always holds, and must still run to the end */
+static void benchsoak(void)
+{
+  static const int eventcaps[] = { 0, 64, 16, 1 };
+  static const int inflightcaps[] = { 0, 16, 4, 0 };
+  char bcase[128];
+  double start, elapsed;
+  int c;
+
+  for (c=0; c<4; c++) {
+    nsimmax = SOAKMESSAGES;
+    lossprob = 0.3;
+    corruptprob = 0.0;
+    corruptdirection = 2;
+    lambda = 1.0;
+    arrivalprocess = ARRIVAL_CBR;
+    eventcap = eventcaps[c];
+    inflightcap = inflightcaps[c];
+    sprintf(bcase, "arrival=cbr;loss=0.3;lambda=1;eventcap=%d;inflightcap=%d",
+            eventcaps[c], inflightcaps[c]);
+
+    seedrandom(9999);
+    teardown();
+    resetsimulation();
+    A_init();
+    B_init();
+    verify = 1;
+    verify_init();
+
+    start = seconds();
+    simulate(0);
+    elapsed = seconds() - start;
+
+    result("soak", bcase, "messages_per_sec", nsim / elapsed);
+    result("soak", bcase, "goodput", messages_delivered / emutime);
+    result("soak", bcase, "event_chunks", nchunks);
+    result("soak", bcase, "event_bytes", (double)nchunks * sizeof(struct eventchunk));
+    result("soak", bcase, "packets_capped", ncapped);
+    result("soak", bcase, "arrivals_held", nheld);
+    result("soak", bcase, "delay_p99", delaypercentile(0.99));
+    result("soak", bcase, "verify_errors", verify_errors());
+    result("soak", bcase, "verify_missing", verify_missing());
+  }
+  arrivalprocess = ARRIVAL_UNIFORM;
+  eventcap = 0;
+  inflightcap = 0;
+  teardown();
+  result("soak", "process", "peak_rss_kb", peakrss());
+}
+
+/* true if section was named on the command line, or none was */
+static int wanted(int argc, char **argv, const char *section)
+{
+  int i;
+
+  if (argc < 2)
+    return 1;
+  for (i=1; i<argc; i++)
+    if (strcmp(argv[i], section) == 0)
+      return 1;
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+#if TRACE_LEVEL < 0
+  TRACE = 0;
+#endif
+  printf("benchmark,protocol,case,metric,value\n");
+  if (wanted(argc, argv, "checksum"))
+    benchchecksum();
+  if (wanted(argc, argv, "queue"))
+    benchqueue();
+  if (wanted(argc, argv, "e2e"))
+    benche2e();
+  if (wanted(argc, argv, "speed"))
+    benchspeed();
+  if (wanted(argc, argv, "capacity"))
+    benchcapacity();
+  if (wanted(argc, argv, "fec"))
+    benchfec();
+  if (wanted(argc, argv, "replay"))
+    benchreplay();
+  if (wanted(argc, argv, "soak"))
+    benchsoak();
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,63 @@
+# Speedup of the production builds over the run time traced builds, from
+# the speed section of several interleaved bench runs on stdin.  Round r
+# of a production build is compared with round r of its traced build,
+# which ran just before it, and the median, least and greatest of those
+# ratios are printed for each case.  Each protocol also gets the median,
+# least and greatest of the median speedups of its cases.  Prints CSV
+# rows like the benchmarks.
+
+# sort v[1..n] in place and return its middle value
+function median(v, n,    i, j, x)
+{
+  for (i=2; i<=n; i++) {
+    x = v[i]
+    for (j=i; j>1 && v[j-1] > x; j--)
+      v[j] = v[j-1]
+    v[j] = x
+  }
+  return v[int((n+1)/2)]
+}
+
+$1 == "speed" && $4 == "events_per_sec" {
+  key = $2 "," $3
+  if (!(key in count))
+    order[++nkeys] = key
+  runs[key, ++count[key]] = $5
+}
+
+END {
+  print "benchmark,protocol,case,metric,value"
+  for (k=1; k<=nkeys; k++) {
+    key = order[k]
+    for (i=1; i<=count[key]; i++)
+      v[i] = runs[key, i]
+    printf "speed,%s,events_per_sec_median,%.6g\n", key, median(v, count[key])
+  }
+  for (k=1; k<=nkeys; k++) {
+    key = order[k]
+    split(key, part, ",")
+    base = part[1]
+    if (sub(/_fast$/, "", base) == 0 || !((base "," part[2]) in count))
+      continue
+    n = count[key] < count[base "," part[2]] ? count[key] : count[base "," part[2]]
+    for (i=1; i<=n; i++)
+      v[i] = runs[key, i] / runs[base "," part[2], i]
+    ratio = median(v, n)
+    printf "speedup,%s,%s,events_per_sec_ratio,%.3f\n", part[1], part[2], ratio
+    printf "speedup,%s,%s,events_per_sec_ratio_min,%.3f\n", part[1], part[2], v[1]
+    printf "speedup,%s,%s,events_per_sec_ratio_max,%.3f\n", part[1], part[2], v[n]
+    ratios[part[1], ++nratios[part[1]]] = ratio
+    if (!(part[1] in seen)) {
+      seen[part[1]] = 1
+      protocols[++nprotocols] = part[1]
+    }
+  }
+  for (p=1; p<=nprotocols; p++) {
+    n = nratios[protocols[p]]
+    for (i=1; i<=n; i++)
+      v[i] = ratios[protocols[p], i]
+    printf "speedup,%s,all,events_per_sec_ratio_median,%.3f\n", protocols[p], median(v, n)
+    printf "speedup,%s,all,events_per_sec_ratio_min,%.3f\n", protocols[p], v[1]
+    printf "speedup,%s,all,events_per_sec_ratio_max,%.3f\n", protocols[p], v[n]
+  }
+}
@@ -24,6 +24,10 @@
    or lost, according to user-defined probabilities
    - packets will be delivered in the order in which they were sent
    (although some can be lost).
+   - with a cap on pending events (-e) or packets in flight (-i), a
+   medium at its cap turns packets away and holds back messages from
+   layer 5 until a packet leaves it, so a run of any length stays in a
+   fixed amount of memory.
 
    Modifications (6/6/2008 - CLP): 
    - removed bidirectional GBN code and other code not used by prac. 
@@ -36,20 +40,44 @@
    ********************************************************************* */
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <sys/resource.h>
 #include "emulator.h"
 #include "gbn.h"
+#include "sampler.h"
+#include "verify.h"
+#include "traffic.h"
+#include "timer.h"
+#include "fec.h"
+#include "profile.h"
+#include "eventlog.h"
 
 struct event {
-  float evtime;           /* event time */
+  double evtime;          /* event time */
   int evtype;             /* event type code */
   int eventity;           /* entity where event occurs */
   struct pkt *pktptr;     /* ptr to packet (if any) assoc w/ this event */
+  struct pkt pkt;         /* storage for the packet, pktptr points here */
+  int damaged;            /* the packet was corrupted in the medium */
   struct event *prev;
   struct event *next;
 };
 
 struct event *evlist = NULL;   /* the event list */
 
+/* events are carved out of chunks and recycled through a free list, so
+   scheduling an event rarely needs a call to malloc */
+#define EVENTCHUNK 256
+struct eventchunk {
+  struct eventchunk *next;
+  struct event events[EVENTCHUNK];
+};
+
+static struct eventchunk *eventchunks = NULL;  /* every chunk allocated so far */
+static struct event *freeevents = NULL;        /* events ready for reuse */
+static int nchunks = 0;                        /* number of chunks allocated */
+
 /* possible events: */
 #define  TIMER_INTERRUPT 0  
 #define  FROM_LAYER5     1
@@ -58,7 +86,9 @@ struct event *evlist = NULL;   /* the event list */
 #define  OFF             0
 #define  ON              1
 
+#if TRACE_LEVEL < 0
 int TRACE = 3;
+#endif
 
 /* statistics updated by GBN */
 int window_full;   /* count of the number of messages dropped due to full window */
@@ -68,15 +98,15 @@ int new_ACKs;           /* count of the number of acks correctly received */
 int packets_received;  /* count of the packets received by receiver */
 
 /* statistics updated by emulator */
-static int packets_lost;  
-static int packets_corrupt;
-static int packets_sent;
-static int packets_timeout;
+static int packets_lost;      /* packets from A lost in the medium */
+static int packets_corrupt;   /* packets from A corrupted in the medium */
+static int packets_sent;      /* packets A handed to layer 3 */
+static int packets_timeout;   /* times A's timer went off */
 static int messages_delivered;
 
 static int nsim = 0;              /* number of messages from 5 to 4 so far */ 
 static int nsimmax = 0;           /* number of msgs to generate, then stop */
-static float time = 0.000;
+static double time = 0.000;       /* simulated time, double so long runs stay exact */
 static float lossprob;            /* probability that a packet is dropped  */
 static float corruptprob;   /* probability that one bit is packet is flipped */
 static int corruptdirection; /* A->B A<-B or bidirectional corruption/loss */
@@ -84,26 +114,139 @@ static float lambda;        /* arrival rate of messages from layer 5 */
 static int   ntolayer3;           /* number sent into layer 3 */
 static int   nlost;               /* number lost in media */
 static int ncorrupt;              /* number corrupted by media*/
+static int nevents;               /* number of events on the event list */
+static int ninflight;             /* number of packets in the medium */
+static int nintact;               /* number of those not corrupted */
+static int nspurious;             /* timeouts at A while an intact packet was in the medium */
+static int ncapped;               /* packets the medium turned away at its caps */
+static int nheld;                 /* times an arrival from layer 5 was held back at the caps */
+
+static double sampleinterval = 0.0;       /* time between metric samples, 0 = off */
+static char *samplefilename = "samples.csv"; /* where metric samples are written */
+static double nextsample;                 /* time the next sample is due */
+static int verify = 0;                    /* check deliveries with the verifier */
+
+#define RANDOMSTATE 128                   /* bytes of random number generator state */
+static unsigned randomseed;               /* seed given to the random number generator */
+static long nrandom;                      /* random numbers drawn since seeding */
+static char randomstate[RANDOMSTATE];     /* the random number generator's state */
+static double snapshottime = -1.0;        /* time to write a snapshot at, < 0 = never */
+static char *snapshotfilename = "snapshot.bin"; /* where the snapshot is written */
+static char *restorefilename = NULL;      /* snapshot to resume from, if any */
+static int arrivalprocess = ARRIVAL_UNIFORM; /* how layer 5 messages arrive */
+static char *profilefilename = NULL;      /* where the profile is written, if anywhere */
+static char *recordfilename = NULL;       /* event log to record the run into, if any */
+static char *replayfilename = NULL;       /* event log to replay instead of simulating */
+static int replaying = 0;                 /* the protocol is being fed an event log */
+static int diverged = 0;                  /* it no longer sends what the log recorded */
+static int fecblock = 0;                  /* data packets per FEC parity packet, 0 = off */
+static struct timer fectimer;             /* sends the parity of a partial FEC block */
+static int eventcap = 0;                  /* most events pending on the event list, 0 = no cap */
+static int inflightcap = 0;               /* most packets in the medium, 0 = no cap */
+
+#define SNAPSHOTMAGIC   "SIMSNAP8"        /* first bytes of every snapshot file */
+#define SNAPSHOTTAG     128               /* bytes of the build tag after the magic */
+#define FECFLUSH        5.0               /* longest a partial FEC block waits for more packets */
+#define FECCHUNK        64                /* packets FEC coded at a time */
+
+/* delay of each message from layer 5 at A to layer 5 at B.  Messages are
+   delivered in the order A accepted them, so the acceptance times of the
+   ones still on their way are kept in a ring */
+#define DELAYRING 4096
+static double accepttime[DELAYRING];      /* when A accepted each undelivered message */
+static int delayfirst;                    /* ring slot of the oldest of them */
+static int delaycount;                    /* number of them */
+static int ndelays;                       /* deliveries timed */
+static double delaysum;                   /* total delay of those deliveries */
+static double delaymax;                   /* longest delay of those deliveries */
+
+/* histogram of the same delays for their percentiles, the last bin also
+   counts every delay beyond the others */
+#define DELAYBINS  1024
+#define DELAYWIDTH 0.5                    /* simulated time covered by each bin */
+static int delaybins[DELAYBINS];
 
 /****************************************************************************/
 /* jimsrand(): return a double in range [0,1].  The routine below is used to */
 /* isolate all random number generation in one location.  We assume that the*/
-/* system-supplied rand() function return an int in therange [0,mmm]        */
+/* system-supplied random() function return an int in therange [0,mmm].     */
+/* It draws from randomstate, which snapshots save and restore directly.    */
 /****************************************************************************/
 double jimsrand(void) 
 {
-  double mmm = RAND_MAX;     /* largest int  - MACHINE DEPENDENT!!!!!!!!   */
+  double mmm = 2147483647.0; /* largest value of random(), 2^31-1 by POSIX */
   double x;                   
-  x = rand()/mmm;            /* x should be uniform in [0,1] */
+  x = random()/mmm;          /* x should be uniform in [0,1] */
+  nrandom++;
   if (TRACE > 3)
     printf("RANDOM NUMBER GENERAION CALLED: %f\n", x);
   return(x);
 }  
 
+/* seed the random number generator and restart the count of draws.  With
+   glibc this gives the numbers srand() and rand() would */
+void seedrandom(unsigned seed)
+{
+  initstate(seed, randomstate, RANDOMSTATE);
+  randomseed = seed;
+  nrandom = 0;
+}
+
 /********************* EVENT HANDLINE ROUTINES *******/
 /*  The next set of routines handle the event list   */
 /*****************************************************/
 
+/* get an event, allocating a new chunk of them when none are free */
+struct event *allocevent(void)
+{
+  struct eventchunk *chunk;
+  struct event *p;
+  int i;
+
+  if (freeevents == NULL) {
+    chunk = malloc(sizeof(struct eventchunk));
+    if (chunk == 0) {
+      printf("memory allocation for event failed.");
+      exit(EXIT_FAILURE);
+    }
+    chunk->next = eventchunks;
+    eventchunks = chunk;
+    nchunks++;
+    for (i=0; i<EVENTCHUNK; i++) {
+      chunk->events[i].next = freeevents;
+      freeevents = &chunk->events[i];
+    }
+  }
+  p = freeevents;
+  freeevents = p->next;
+  p->pktptr = NULL;
+  return p;
+}
+
+/* return an event, and the packet it carries, to the free list */
+void freeevent(struct event *p)
+{
+  p->next = freeevents;
+  freeevents = p;
+}
+
+/* true if the event list or the medium is full up to its cap */
+static int atcap(void)
+{
+  return (eventcap > 0 && nevents >= eventcap)
+    || (inflightcap > 0 && ninflight >= inflightcap);
+}
+
+/* the packet that leaves the medium next, NULL if it is empty */
+static struct event *nextpacket(void)
+{
+  struct event *q;
+
+  for (q=evlist; q!=NULL && q->evtype!=FROM_LAYER3; q=q->next)
+    ;
+  return q;
+}
+
 void insertevent(struct event *p)
 {
   struct event *q,*qold;
@@ -112,6 +255,9 @@ void insertevent(struct event *p)
     printf("            INSERTEVENT: time is %f\n",time);
     printf("            INSERTEVENT: future time will be %f\n",p->evtime); 
   }
+  nevents++;
+  PROFILE_COUNT(inserts);
+  PROFILE_HIGH(evlisthigh, nevents);
   q = evlist;     /* q points to front of list in which p struct inserted */
   if (q==NULL) {   /* list is empty */
     evlist=p;
@@ -119,8 +265,10 @@ void insertevent(struct event *p)
     p->prev=NULL;
   }
   else {
-    for (qold = q; q !=NULL && p->evtime > q->evtime; q=q->next)
+    for (qold = q; q !=NULL && p->evtime > q->evtime; q=q->next) {
       qold=q; 
+      PROFILE_COUNT(insertscan);
+    }
     if (q==NULL) {   /* end of list */
       qold->next = p;
       p->prev = qold;
@@ -149,14 +297,14 @@ void generate_next_arrival(void)
   if (TRACE>2)
     printf("          GENERATE NEXT ARRIVAL: creating new arrival\n");
  
-  x = lambda*jimsrand()*2;  /* x is uniform on [0,2*lambda] */
-  /* having mean of lambda        */
-  evptr = malloc(sizeof(struct event));
-  if (evptr == 0) {
-    printf("memory allocation for event failed.");
-    exit(EXIT_FAILURE);
+  x = traffic_next(arrivalprocess, lambda, time);
+  if (x < 0.0) {
+    if (TRACE>2)
+      printf("          GENERATE NEXT ARRIVAL: arrival trace has ended\n");
+    return;
   }
-  evptr->evtime =  time + x;
+  evptr = allocevent();
+  evptr->evtime =  x;
   evptr->evtype =  FROM_LAYER5;
   if (BIDIRECTIONAL && (jimsrand()>0.5) )
     evptr->eventity = B;
@@ -175,10 +323,172 @@ void printevlist(void)
   printf("--------------\n");
 }
 
+/* record the state of the simulator at time sampletime */
+void takesample(double sampletime)
+{
+  struct sample s;
+
+  s.time = sampletime;
+  s.nsim = nsim;
+  s.windowcount = A_windowcount();
+  s.bufcount = B_buffercount();
+  s.inflight = ninflight;
+  s.evcount = nevents;
+  s.ntolayer3 = ntolayer3;
+  s.nlost = nlost;
+  s.ncorrupt = ncorrupt;
+  s.window_full = window_full;
+  s.packets_resent = packets_resent;
+  s.new_ACKs = new_ACKs;
+  s.packets_received = packets_received;
+  s.messages_delivered = messages_delivered;
+  sampler_write(&s);
+}
+
+/* parse the command line options of the simulator */
+void parseargs(int argc, char **argv)
+{
+  int i;
+
+  for (i=1; i<argc; i++) {
+    if (strcmp(argv[i], "-m") == 0 && i+1 < argc)
+      sampleinterval = atof(argv[++i]);
+    else if (strcmp(argv[i], "-o") == 0 && i+1 < argc)
+      samplefilename = argv[++i];
+    else if (strcmp(argv[i], "-v") == 0)
+      verify = 1;
+    else if (strcmp(argv[i], "-s") == 0 && i+1 < argc)
+      snapshottime = atof(argv[++i]);
+    else if (strcmp(argv[i], "-S") == 0 && i+1 < argc)
+      snapshotfilename = argv[++i];
+    else if (strcmp(argv[i], "-r") == 0 && i+1 < argc)
+      restorefilename = argv[++i];
+    else if (strcmp(argv[i], "-a") == 0 && i+1 < argc
+             && (arrivalprocess = traffic_process(argv[++i])) >= 0
+             && arrivalprocess != ARRIVAL_TRACE)
+      ;
+    else if (strcmp(argv[i], "-f") == 0 && i+1 < argc
+             && (fecblock = atoi(argv[++i])) >= 0 && fecblock <= FECMAXK)
+      ;
+    else if (strcmp(argv[i], "-p") == 0 && i+1 < argc)
+      profilefilename = argv[++i];
+    else if (strcmp(argv[i], "-R") == 0 && i+1 < argc)
+      recordfilename = argv[++i];
+    else if (strcmp(argv[i], "-P") == 0 && i+1 < argc)
+      replayfilename = argv[++i];
+    else if (strcmp(argv[i], "-e") == 0 && i+1 < argc
+             && (eventcap = atoi(argv[++i])) >= 0)
+      ;
+    else if (strcmp(argv[i], "-i") == 0 && i+1 < argc
+             && (inflightcap = atoi(argv[++i])) >= 0)
+      ;
+    else if (strcmp(argv[i], "-t") == 0 && i+1 < argc) {
+      if (!traffic_opentrace(argv[++i]))
+        exit(EXIT_FAILURE);
+      arrivalprocess = ARRIVAL_TRACE;
+    }
+    else {
+      printf("usage: %s [-m sample interval] [-o sample file] [-v]\n"
+             "          [-s snapshot time] [-S snapshot file] [-r restore file]\n"
+             "          [-a uniform|poisson|onoff|cbr] [-t arrival trace file]\n"
+             "          [-f FEC block size] [-p profile file]\n"
+             "          [-R record event log] [-P replay event log]\n"
+             "          [-e max pending events] [-i max packets in flight]\n", argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+  /* a log replays from the start of a run, through no event list */
+  if ((recordfilename != NULL || replayfilename != NULL) && restorefilename != NULL) {
+    printf("an event log covers a whole run, so -R and -P can not be used with -r\n");
+    exit(EXIT_FAILURE);
+  }
+  if (replayfilename != NULL && (recordfilename != NULL || snapshottime >= 0.0)) {
+    printf("a replayed run has no event list, so -P can not be used with -R or -s\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+/* clear the statistics and schedule the first arrival at time 0 */
+void resetsimulation(void)
+{
+  /* initialise statistics */
+  window_full = 0;
+  total_ACKs_received = 0;
+  packets_resent = 0;
+  new_ACKs = 0;
+  packets_received = 0;
+  packets_lost = 0;  
+  packets_corrupt = 0;
+  packets_sent = 0;
+  packets_timeout = 0;
+  messages_delivered = 0;
+
+  ntolayer3 = 0;
+  nlost = 0;
+  ncorrupt = 0;
+  nevents = 0;
+  ninflight = 0;
+  nintact = 0;
+  nspurious = 0;
+  ncapped = 0;
+  nheld = 0;
+  delayfirst = 0;
+  delaycount = 0;
+  ndelays = 0;
+  delaysum = 0.0;
+  delaymax = 0.0;
+  memset(delaybins, 0, sizeof(delaybins));
+  profile_reset();
+
+  nsim = 0;
+  traffic_reset();
+  time=0.0;                    /* initialize time to 0.0 */
+  timer_reset(time);
+  fec_init(fecblock);
+  generate_next_arrival();     /* initialize event list */
+}
+
+/* free every event and close everything the run opened, so it ends with
+   none of its state left allocated */
+void teardown(void)
+{
+  struct eventchunk *chunk;
+
+  while (eventchunks != NULL) {
+    chunk = eventchunks;
+    eventchunks = chunk->next;
+    free(chunk);
+  }
+  nchunks = 0;
+  evlist = NULL;
+  freeevents = NULL;
+  nevents = 0;
+  ninflight = 0;
+  nintact = 0;
+  timer_reset(time);
+  eventlog_close();
+  sampler_close();
+  traffic_close();
+}
+
+/* most memory the process has ever had resident, in kilobytes, or -1 if
+   the system does not say */
+static long peakrss(void)
+{
+  struct rusage usage;
+
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return -1;
+  return usage.ru_maxrss;
+}
+
 void init(void)                         /* initialize the simulator */
 {
   float sum, avg;
   int i;
+#if TRACE_LEVEL >= 0
+  int trace;     /* read to keep the prompts in step, the build fixes the level */
+#endif
 
   printf("-----  Stop and Wait Network Simulator Version 1.1 -------- \n\n");
   printf("Enter the number of messages to simulate: ");
@@ -194,10 +504,14 @@ void init(void)                         /* initialize the simulator */
   printf("Enter average time between messages from sender's layer5 [ > 0.0]:");
   scanf("%f",&lambda);
   printf("Enter TRACE:");
+#if TRACE_LEVEL < 0
   scanf("%d",&TRACE);
+#else
+  scanf("%d",&trace);
+#endif
 
 
-  srand(9999);              /* init random number generator */
+  seedrandom(9999);         /* init random number generator */
   sum = 0.0;                /* test random number generator for students */
   for (i=0; i<1000; i++)
     sum+=jimsrand();    /* jimsrand() should be uniform in [0,1] */
@@ -209,24 +523,7 @@ void init(void)                         /* initialize the simulator */
     exit(EXIT_FAILURE);
   }
 
-  /* initialise statistics */
-  window_full = 0;
-  total_ACKs_received = 0;
-  packets_resent = 0;
-  new_ACKs = 0;
-  packets_received = 0;
-  packets_lost = 0;  
-  packets_corrupt = 0;
-  packets_sent = 0;
-  packets_timeout = 0;
-  messages_delivered = 0;
-
-  ntolayer3 = 0;
-  nlost = 0;
-  ncorrupt = 0;
-
-  time=0.0;                    /* initialize time to 0.0 */
-  generate_next_arrival();     /* initialize event list */
+  resetsimulation();
 }
 
 /********************** Student-callable ROUTINES ***********************/
@@ -237,10 +534,14 @@ void stoptimer(int AorB)
 {
   struct event *q;
 
+  if (replaying)
+    return;              /* the event log holds the interrupts */
   if (TRACE>1)
     printf("          STOP TIMER: stopping timer at %f\n",time);
+  PROFILE_COUNT(timerstops);
   /* for (q=evlist; q!=NULL && q->next!=NULL; q = q->next)  */
-  for (q=evlist; q!=NULL ; q = q->next) 
+  for (q=evlist; q!=NULL ; q = q->next) {
+    PROFILE_COUNT(timerstopscan);
     if ( (q->evtype==TIMER_INTERRUPT  && q->eventity==AorB) ) { 
       /* remove this event */
       if (q->next==NULL && q->prev==NULL)
@@ -255,9 +556,11 @@ void stoptimer(int AorB)
         q->next->prev = q->prev;
         q->prev->next =  q->next;
       }
-      free(q);
+      freeevent(q);
+      nevents--;
       return;
     }
+  }
   printf("Warning: unable to cancel your timer. It wasn't running.\n");
 }
 
@@ -269,22 +572,24 @@ void starttimer(int AorB, double increment)
   struct event *q;
   struct event *evptr;
 
+  if (replaying)
+    return;              /* the event log holds the interrupts */
   if (TRACE>1)
     printf("          START TIMER: starting timer at %f\n",time);
+  PROFILE_COUNT(timerstarts);
   /* be nice: check to see if timer is already started, if so, then  warn */
   /* for (q=evlist; q!=NULL && q->next!=NULL; q = q->next)  */
-  for (q=evlist; q!=NULL ; q = q->next)  
+  for (q=evlist; q!=NULL ; q = q->next) {
+    PROFILE_COUNT(timerstartscan);
     if ( (q->evtype==TIMER_INTERRUPT  && q->eventity==AorB) ) { 
+      PROFILE_COUNT(timersrejected);
       printf("Warning: attempt to start a timer that is already started\n");
       return;
     }
+  }
  
   /* create future event for when timer goes off */
-  evptr = malloc(sizeof(struct event));
-  if (evptr == 0) {
-    printf("memory allocation for event failed.");
-    exit(EXIT_FAILURE);
-  }
+  evptr = allocevent();
   evptr->evtime =  time + increment;
   evptr->evtype =  TIMER_INTERRUPT;
    
@@ -293,85 +598,281 @@ void starttimer(int AorB, double increment)
   insertevent(evptr);
 } 
 
+/* called by students routine to start a timer from the timer service.
+   Unlike starttimer(), any number of these can run at each entity, and
+   they never touch the event list. */
+void settimer(struct timer *t, int AorB, double increment,
+              void (*handler)(int, void *), void *cookie)
+{
+  if (TRACE>1)
+    printf("          SET TIMER: setting timer at %f to go off at %f\n",time,time+increment);
+  if (increment < 0.0)
+    increment = 0.0;
+  PROFILE_COUNT(settimers);
+  if (t->slot != NULL)
+    PROFILE_COUNT(rearms);
+  t->entity = AorB;
+  t->handler = handler;
+  t->cookie = cookie;
+  timer_arm(t, time + increment);
+}
+
+/* called by students routine to stop a timer from the timer service */
+void canceltimer(struct timer *t)
+{
+  if (TRACE>1 && t->slot != NULL)
+    printf("          CANCEL TIMER: cancelling timer at %f\n",time);
+  if (t->slot != NULL)
+    PROFILE_COUNT(cancels);
+  timer_disarm(t);
+}
+
+/* called by students routine to read the clock */
+double simtime(void)
+{
+  return time;
+}
+
+/* called by students routine to see how long a timer has left to run */
+double timerremaining(struct timer *t)
+{
+  if (t->slot == NULL)
+    return -1.0;
+  return t->expiry - time;
+}
+
 
 /************************** TOLAYER3 ***************/
 void tolayer3(int AorB, struct pkt packet)
 /* A or B is sending to network  */
+{
+  tolayer3_batch(AorB, &packet, 1);
+}
+
+/* put count packets from A or B into the medium in one go.  Each packet is
+   lost, delayed and corrupted exactly as if it had been sent on its own,
+   but the end of the channel is found only once and the arrivals, which
+   are in time order, are merged into the event list in a single pass. */
+static void tochannel(int AorB, struct pkt *packets, int count)
 {
   struct pkt *mypktptr;
-  struct event *evptr,*q;
-  float lastime, x;
-  int i;
+  struct event *evptr, *q, *qold, *tail;
+  struct event *run = NULL, *runlast = NULL;
+  double lastime;
+  float x;
+  int dest = (AorB+1) % 2;   /* packets pop out at the other entity */
+  int i, n, nrun = 0;
 
-  ntolayer3++;
+  ntolayer3 += count;
+  if (AorB == A)
+    packets_sent += count;
+  PROFILE_COUNT(sends);
 
-  /* simulate losses: */
-  if (jimsrand() < lossprob && (!(AorB == B && corruptdirection == A) && !(AorB == A && corruptdirection == B))) {
-    nlost++;
-    if (TRACE>0)    
-      printf("          TOLAYER3: packet being lost\n");
-    return;
-  }  
+  /* medium can not reorder, so every packet arrives between 1 and 10
+     time units after the latest arrival time of packets currently in
+     the medium on their way to the destination */
+  lastime = time;
+  tail = NULL;
+  for (q=evlist; q!=NULL ; q = q->next) {
+    PROFILE_COUNT(sendscan);
+    if ( (q->evtype==FROM_LAYER3  && q->eventity==dest) ) {
+      lastime = q->evtime;
+      tail = q;
+    }
+  }
 
-  /* make a copy of the packet student just gave me since he/she may decide */
-  /* to do something with the packet after we return back to him/her */ 
-  mypktptr = malloc(sizeof(struct pkt));
-  if (mypktptr == 0) {
-    printf("memory allocation for event failed.");
-    exit(EXIT_FAILURE);
+  for (n=0; n<count; n++) {
+    /* a medium at its cap has no room for the packet, like a full queue.
+       An empty medium always takes one, as the event list always holds
+       the next arrival or a timer and held arrivals wait for a packet to
+       leave, so without it a small event cap would stop the run dead */
+    if ((ninflight > 0 || nrun > 0)
+        && ((eventcap > 0 && nevents + nrun >= eventcap)
+            || (inflightcap > 0 && ninflight + nrun >= inflightcap))) {
+      ncapped++;
+      if (TRACE>0)
+        printf("          TOLAYER3: packet turned away, the medium is at its cap\n");
+      continue;
+    }
+
+    /* simulate losses: */
+    if (jimsrand() < lossprob && (!(AorB == B && corruptdirection == A) && !(AorB == A && corruptdirection == B))) {
+      nlost++;
+      if (AorB == A)
+        packets_lost++;
+      if (TRACE>0)    
+        printf("          TOLAYER3: packet being lost\n");
+      continue;
+    }  
+
+    /* make a copy of the packet student just gave me since he/she may decide */
+    /* to do something with the packet after we return back to him/her */ 
+    evptr = allocevent();
+    mypktptr = &evptr->pkt;
+    *mypktptr = packets[n];
+    if (TRACE>2)  {
+      printf("          TOLAYER3: seq: %d, ack %d, check: %d ", mypktptr->seqnum,
+             mypktptr->acknum,  mypktptr->checksum);
+      for (i=0; i<20; i++)
+        printf("%c",mypktptr->payload[i]);
+      printf("\n");
+    }
+
+    /* create future event for arrival of packet at the other side */
+    evptr->evtype =  FROM_LAYER3;   /* packet will pop out from layer3 */
+    evptr->eventity = dest;         /* event occurs at other entity */
+    evptr->pktptr = mypktptr;       /* save ptr to my copy of packet */
+    evptr->evtime =  lastime + 1 + 9*jimsrand();
+    evptr->damaged = 0;
+    lastime = evptr->evtime;
+
+    /* simulate corruption: */
+    if ((jimsrand() < corruptprob)  && (!(AorB == B && corruptdirection == A) && !(AorB == A && corruptdirection == B))) {
+      ncorrupt++;
+      if (AorB == A)
+        packets_corrupt++;
+      if ( (x = jimsrand()) < .75)
+        mypktptr->payload[0]='Z';   /* corrupt payload */
+      else if (x < .875)
+        mypktptr->seqnum = 999999;
+      else
+        mypktptr->acknum = 999999;
+      evptr->damaged = 1;
+      if (TRACE>0)    
+        printf("          TOLAYER3: packet being corrupted\n");
+    }  
+
+    if (TRACE>2)  
+      printf("          TOLAYER3: scheduling arrival on other side\n");
+
+    /* add to the run of arrivals, which is in time order */
+    evptr->next = NULL;
+    if (runlast == NULL)
+      run = evptr;
+    else
+      runlast->next = evptr;
+    runlast = evptr;
+    nrun++;
   }
-  mypktptr->seqnum = packet.seqnum;
-  mypktptr->acknum = packet.acknum;
-  mypktptr->checksum = packet.checksum;
-  for (i=0; i<20; i++)
-    mypktptr->payload[i] = packet.payload[i];
-  if (TRACE>2)  {
-    printf("          TOLAYER3: seq: %d, ack %d, check: %d ", mypktptr->seqnum,
-           mypktptr->acknum,  mypktptr->checksum);
-    for (i=0; i<20; i++)
-      printf("%c",mypktptr->payload[i]);
-    printf("\n");
+
+  /* merge the run into the event list.  Every arrival is later than the
+     end of the channel, so the merge can start there */
+  if (tail == NULL) {
+    qold = NULL;
+    q = evlist;
+  }
+  else {
+    qold = tail;
+    q = tail->next;
+  }
+  while (run != NULL) {
+    evptr = run;
+    run = run->next;
+    if (TRACE>2) {
+      printf("            INSERTEVENT: time is %f\n",time);
+      printf("            INSERTEVENT: future time will be %f\n",evptr->evtime); 
+    }
+    for (; q != NULL && evptr->evtime > q->evtime; q = q->next) {
+      qold = q;
+      PROFILE_COUNT(sendscan);
+    }
+    evptr->prev = qold;
+    evptr->next = q;
+    if (qold == NULL)
+      evlist = evptr;
+    else
+      qold->next = evptr;
+    if (q != NULL)
+      q->prev = evptr;
+    qold = evptr;
+    nevents++;
+    PROFILE_HIGH(evlisthigh, nevents);
+    ninflight++;
+    if (!evptr->damaged)
+      nintact++;
   }
+} 
 
-  /* create future event for arrival of packet at the other side */
-  evptr = malloc(sizeof(struct event));
-  if (evptr == 0) {
-    printf("memory allocation for event failed.");
-    exit(EXIT_FAILURE);
+/* the FEC block at A has waited long enough, send its parity packet */
+static void fecflush(int AorB, void *cookie)
+{
+  struct pkt parity;
+
+  (void)cookie;
+  if (fec_flush(&parity))
+    tochannel(AorB, &parity, 1);
+}
+
+/* FEC code count packets from A and put them into the medium */
+static void fecencode(struct pkt *packets, int count)
+{
+  struct pkt coded[2*FECCHUNK + 1];
+  int n;
+
+  for (; count > 0; packets += n, count -= n) {
+    n = count < FECCHUNK ? count : FECCHUNK;
+    tochannel(A, coded, fec_encode(packets, n, coded));
   }
-  evptr->evtype =  FROM_LAYER3;   /* packet will pop out from layer3 */
-  evptr->eventity = (AorB+1) % 2; /* event occurs at other entity */
-  evptr->pktptr = mypktptr;       /* save ptr to my copy of packet */
-  /* finally, compute the arrival time of packet at the other end.
-     medium can not reorder, so make sure packet arrives between 1 and 10
-     time units after the latest arrival time of packets
-     currently in the medium on their way to the destination */
-  lastime = time;
-  /* for (q=evlist; q!=NULL && q->next!=NULL; q = q->next) */
-  for (q=evlist; q!=NULL ; q = q->next) 
-    if ( (q->evtype==FROM_LAYER3  && q->eventity==evptr->eventity) ) 
-      lastime = q->evtime;
-  evptr->evtime =  lastime + 1 + 9*jimsrand();
- 
+  if (fec_pending() == 0)
+    canceltimer(&fectimer);
+  else if (fectimer.slot == NULL)
+    settimer(&fectimer, A, FECFLUSH, fecflush, NULL);
+}
 
+static void logevent(int type, int AorB, int intact, const struct msg *msg,
+                     const struct pkt *pkt);
+static void checksends(int AorB, struct pkt *packets, int count);
 
-  /* simulate corruption: */
-  if ((jimsrand() < corruptprob)  && (!(AorB == B && corruptdirection == A) && !(AorB == A && corruptdirection == B))) {
-    ncorrupt++;
-    if ( (x = jimsrand()) < .75)
-      mypktptr->payload[0]='Z';   /* corrupt payload */
-    else if (x < .875)
-      mypktptr->seqnum = 999999;
-    else
-      mypktptr->acknum = 999999;
-    if (TRACE>0)    
-      printf("          TOLAYER3: packet being corrupted\n");
-  }  
+/* send count packets from A or B in one go, FEC coding them when A sends */
+void tolayer3_batch(int AorB, struct pkt *packets, int count)
+{
+  int i;
 
-  if (TRACE>2)  
-    printf("          TOLAYER3: scheduling arrival on other side\n");
-  insertevent(evptr);
-} 
+  if (replaying) {
+    checksends(AorB, packets, count);
+    return;
+  }
+  if (recordfilename != NULL)
+    for (i=0; i<count; i++)
+      logevent(LOG_SEND, AorB, 0, NULL, &packets[i]);
+  if (fecblock == 0 || AorB != A)
+    PROFILE_CALL(PROF_TOLAYER3, tochannel(AorB, packets, count));
+  else
+    PROFILE_CALL(PROF_TOLAYER3, fecencode(packets, count));
+}
+
+/* time the delivery at B of the count messages A accepted the longest ago */
+static void timedeliveries(int count)
+{
+  double delay;
+
+  for (; count > 0 && delaycount > 0; count--) {
+    delay = time - accepttime[delayfirst];
+    delayfirst = (delayfirst + 1) % DELAYRING;
+    delaycount--;
+    ndelays++;
+    delaysum += delay;
+    if (delay > delaymax)
+      delaymax = delay;
+    delaybins[delay < DELAYBINS * DELAYWIDTH ? (int)(delay / DELAYWIDTH) : DELAYBINS - 1]++;
+  }
+}
+
+/* delay not exceeded by the fraction p of the timed deliveries, to the
+   resolution of the histogram */
+static double delaypercentile(double p)
+{
+  long need = (long)ceil(p * ndelays);
+  long seen = 0;
+  int bin;
+
+  for (bin=0; bin<DELAYBINS-1; bin++) {
+    seen += delaybins[bin];
+    if (seen >= need)
+      return (bin + 1) * DELAYWIDTH;
+  }
+  return delaymax;
+}
 
 void tolayer5(int AorB, char datasent[20])
 {
@@ -386,28 +887,356 @@ void tolayer5(int AorB, char datasent[20])
       printf("%c",datasent[i]);
     printf("\n");
   }
+  if (verify && AorB == B)
+    verify_delivered(datasent);
+  if (AorB == B)
+    timedeliveries(1);
   messages_delivered++;
 }
 
-int main(void)
+void tolayer5_batch(int AorB, struct msg *msgs, int count)
+{
+  int i;
+
+  if (TRACE>2 || verify) {
+    for (i=0; i<count; i++)
+      tolayer5(AorB, msgs[i].data);
+    return;
+  }
+  if (AorB == B)
+    timedeliveries(count);
+  messages_delivered += count;
+}
+
+/************************** SNAPSHOTS ***************/
+/* A snapshot holds the clock, statistics, random number generator  */
+/* position, event list and protocol state, written in the native   */
+/* byte order, so it must be restored by the same build.  After   */
+/* the magic comes a tag naming the protocol and build options and */
+/* the size of the protocol state, and a snapshot whose tag or size */
+/* differ, or whose length is wrong, is refused.  The               */
+/* channel settings (loss, corruption, lambda, number of messages)  */
+/* are not part of it: a restored run takes them from the prompts,  */
+/* so one warmed up state can be resumed under different settings.  */
+/****************************************************/
+
+#define SAVE(x) (fwrite(&(x), sizeof(x), 1, fp) == 1)
+#define LOAD(x) (fread(&(x), sizeof(x), 1, fp) == 1)
+
+/* the tag of this build, padded with zeros */
+static void buildtag(char tag[SNAPSHOTTAG])
+{
+  memset(tag, 0, SNAPSHOTTAG);
+  sprintf(tag, "%.96s trace=%d profile=%d", protocol_config(), TRACE_LEVEL, PROFILE);
+}
+
+void savesimulation(const char *filename)
+{
+  FILE *fp;
+  struct event *q;
+  double fecwait;
+  char tag[SNAPSHOTTAG];
+  long statesize = protocol_statesize();
+  int ok;
+
+  fp = fopen(filename, "wb");
+  if (fp == NULL) {
+    printf("unable to open snapshot file %s\n", filename);
+    exit(EXIT_FAILURE);
+  }
+  ok = fwrite(SNAPSHOTMAGIC, 1, 8, fp) == 8;
+  buildtag(tag);
+  ok = ok && SAVE(tag) && SAVE(statesize);
+  setstate(randomstate);      /* record where the generator is in its state */
+  ok = ok && SAVE(time) && SAVE(nsim) && SAVE(randomseed) && SAVE(nrandom)
+    && SAVE(randomstate);
+  ok = ok && SAVE(window_full) && SAVE(total_ACKs_received) && SAVE(packets_resent)
+    && SAVE(new_ACKs) && SAVE(packets_received) && SAVE(packets_lost)
+    && SAVE(packets_corrupt) && SAVE(packets_sent) && SAVE(packets_timeout)
+    && SAVE(messages_delivered) && SAVE(ntolayer3) && SAVE(nlost) && SAVE(ncorrupt);
+  ok = ok && SAVE(nevents);
+  for (q=evlist; ok && q!=NULL; q=q->next) {
+    ok = SAVE(q->evtime) && SAVE(q->evtype) && SAVE(q->eventity);
+    if (ok && q->evtype == FROM_LAYER3)
+      ok = SAVE(*q->pktptr) && SAVE(q->damaged);
+  }
+  ok = ok && SAVE(accepttime) && SAVE(delayfirst) && SAVE(delaycount)
+    && SAVE(ndelays) && SAVE(delaysum) && SAVE(delaymax) && SAVE(delaybins);
+  ok = ok && SAVE(nspurious) && SAVE(ncapped) && SAVE(nheld);
+  fecwait = timerremaining(&fectimer);
+  ok = ok && SAVE(fecblock) && SAVE(fecwait) && fec_save(fp);
+  ok = ok && save_protocol(fp) && traffic_save(fp);
+  ok = ok && SAVE(verify) && (!verify || verify_save(fp));
+  if (fclose(fp) != 0 || !ok) {
+    printf("unable to write snapshot file %s\n", filename);
+    exit(EXIT_FAILURE);
+  }
+  if (TRACE>0)
+    printf("          SNAPSHOT: simulation state at time %f written to %s\n", time, filename);
+}
+
+void restoresimulation(const char *filename)
+{
+  FILE *fp;
+  struct event *q, *last;
+  double fecwait;
+  char magic[8];
+  char tag[SNAPSHOTTAG], ourtag[SNAPSHOTTAG];
+  char savedstate[RANDOMSTATE];
+  long statesize;
+  int count, i, ok;
+
+  fp = fopen(filename, "rb");
+  if (fp == NULL) {
+    printf("unable to open snapshot file %s\n", filename);
+    exit(EXIT_FAILURE);
+  }
+
+  /* throw away the event list built by init() */
+  while (evlist != NULL) {
+    q = evlist;
+    evlist = evlist->next;
+    freeevent(q);
+  }
+
+  ok = fread(magic, 1, 8, fp) == 8 && memcmp(magic, SNAPSHOTMAGIC, 8) == 0;
+  ok = ok && LOAD(tag) && LOAD(statesize);
+  buildtag(ourtag);
+  if (ok && (memcmp(tag, ourtag, SNAPSHOTTAG) != 0 || statesize != protocol_statesize())) {
+    tag[SNAPSHOTTAG-1] = '\0';
+    printf("snapshot file %s is not a snapshot of this build, it was written by\n"
+           "  %s with %ld bytes of protocol state, not\n  %s with %ld\n",
+           filename, tag, statesize, ourtag, protocol_statesize());
+    exit(EXIT_FAILURE);
+  }
+  ok = ok && LOAD(time) && LOAD(nsim) && LOAD(randomseed) && LOAD(nrandom)
+    && LOAD(savedstate);
+  ok = ok && LOAD(window_full) && LOAD(total_ACKs_received) && LOAD(packets_resent)
+    && LOAD(new_ACKs) && LOAD(packets_received) && LOAD(packets_lost)
+    && LOAD(packets_corrupt) && LOAD(packets_sent) && LOAD(packets_timeout)
+    && LOAD(messages_delivered) && LOAD(ntolayer3) && LOAD(nlost) && LOAD(ncorrupt);
+  ok = ok && LOAD(count);
+
+  /* the events were saved in time order, so append them */
+  nevents = 0;
+  ninflight = 0;
+  nintact = 0;
+  last = NULL;
+  for (i=0; ok && i<count; i++) {
+    q = allocevent();
+    ok = LOAD(q->evtime) && LOAD(q->evtype) && LOAD(q->eventity);
+    if (ok && q->evtype == FROM_LAYER3) {
+      q->pktptr = &q->pkt;
+      ok = LOAD(*q->pktptr) && LOAD(q->damaged);
+      ninflight++;
+      if (!q->damaged)
+        nintact++;
+    }
+    q->prev = last;
+    q->next = NULL;
+    if (last == NULL)
+      evlist = q;
+    else
+      last->next = q;
+    last = q;
+    nevents++;
+  }
+  PROFILE_HIGH(evlisthigh, nevents);
+
+  ok = ok && LOAD(accepttime) && LOAD(delayfirst) && LOAD(delaycount)
+    && LOAD(ndelays) && LOAD(delaysum) && LOAD(delaymax) && LOAD(delaybins);
+  ok = ok && LOAD(nspurious) && LOAD(ncapped) && LOAD(nheld);
+
+  /* the protocol owns its timers and arms them again as it is restored */
+  timer_reset(time);
+  ok = ok && LOAD(fecblock) && LOAD(fecwait) && fec_restore(fp);
+  if (ok && fecwait >= 0.0)
+    settimer(&fectimer, A, fecwait, fecflush, NULL);
+  ok = ok && restore_protocol(fp) && traffic_restore(fp);
+  ok = ok && LOAD(verify) && (!verify || verify_restore(fp));
+  ok = ok && fgetc(fp) == EOF;     /* nothing may follow the last field */
+  if (!ok) {
+    printf("snapshot file %s is not a valid snapshot\n", filename);
+    exit(EXIT_FAILURE);
+  }
+  fclose(fp);
+
+  /* put the random number generator back where it was.  Switching to the
+     saved state first keeps setstate() from overwriting the position it
+     holds with the current one */
+  setstate(savedstate);
+  memcpy(randomstate, savedstate, RANDOMSTATE);
+  setstate(randomstate);
+
+  if (TRACE>0)
+    printf("          SNAPSHOT: simulation state at time %f restored from %s\n", time, filename);
+}
+
+/************************** EVENT LOG ***************/
+/* Every input to the protocol entities goes through the give   */
+/* functions below, which append it to the event log when one   */
+/* is recorded.  A replay calls the same functions with the     */
+/* logged inputs and checks each packet the entities send       */
+/* against the log.                                             */
+/****************************************************/
+
+/* append an input or output of the protocol to the event log */
+static void logevent(int type, int AorB, int intact, const struct msg *msg,
+                     const struct pkt *pkt)
+{
+  struct logrecord r;
+
+  r.type = type;
+  r.entity = AorB;
+  r.intact = intact;
+  r.time = time;
+  if (msg != NULL)
+    r.msg = *msg;
+  if (pkt != NULL)
+    r.pkt = *pkt;
+  eventlog_write(&r);
+}
+
+/* the replayed protocol did not do what the log recorded */
+static void diverge(const char *what)
+{
+  if (!diverged)
+    printf("REPLAY: protocol diverged from the event log at time %f: %s\n", time, what);
+  diverged = 1;
+}
+
+/* match packets sent by the replayed protocol against the log */
+static void checksends(int AorB, struct pkt *packets, int count)
 {
-  struct event *eventptr;
+  struct logrecord r;
+  int i;
+
+  for (i=0; i<count && !diverged; i++) {
+    if (!eventlog_read(&r))
+      diverge("it sent a packet after the end of the log");
+    else if (r.type != LOG_SEND || r.entity != AorB)
+      diverge("it sent a packet the recorded run did not");
+    else if (memcmp(&r.pkt, &packets[i], sizeof(struct pkt)) != 0)
+      diverge("it sent a different packet");
+  }
+}
+
+/* give message msg from layer 5 to entity AorB */
+static void givemessage(int AorB, struct msg *msg)
+{
+  int i, j;
+
+  if (verify && AorB == A)
+    verify_generate(msg, nsim);
+  if (recordfilename != NULL)
+    logevent(LOG_LAYER5, AorB, 0, msg, NULL);
+  if (TRACE>2) {
+    printf("          MAINLOOP: data given to student: ");
+    for (i=0; i<20; i++) 
+      printf("%c", msg->data[i]);
+    printf("\n");
+  }
+  nsim++;
+  if (AorB == A) {
+    /* A counts every message it drops because its window is full */
+    j = window_full;
+    PROFILE_CALL(PROF_A_OUTPUT, A_output(*msg));
+    if (window_full == j && delaycount < DELAYRING) {
+      accepttime[(delayfirst + delaycount) % DELAYRING] = time;
+      delaycount++;
+    }
+    if (verify)
+      verify_accepted(nsim-1, window_full == j);
+  }
+  else
+    B_output(*msg);  
+}
+
+/* give packet pkt arriving from layer 3 to entity AorB */
+static void givepacket(int AorB, struct pkt pkt)
+{
+  if (recordfilename != NULL)
+    logevent(LOG_LAYER3, AorB, 0, NULL, &pkt);
+  if (AorB == A)
+    PROFILE_CALL(PROF_A_INPUT, A_input(pkt));
+  else
+    PROFILE_CALL(PROF_B_INPUT, B_input(pkt));
+}
+
+/* the timer of entity AorB went off, with intact packets in the medium or not */
+static void giveinterrupt(int AorB, int intact)
+{
+  if (recordfilename != NULL)
+    logevent(LOG_TIMER, AorB, intact, NULL, NULL);
+  if (AorB == A) {
+    /* nothing was lost if a packet sent intact is still on its way */
+    packets_timeout++;
+    if (intact)
+      nspurious++;
+    PROFILE_CALL(PROF_A_TIMER, A_timerinterrupt());
+  }
+  else
+    PROFILE_CALL(PROF_B_TIMER, B_timerinterrupt());
+}
+
+/* timer from the timer service goes off; the FEC flush timer belongs to
+   the emulator, not the protocol, so it is not logged */
+static void givetimer(struct timer *timer)
+{
+  timer_disarm(timer);
+  if (TRACE>=2)
+    printf("\nEVENT time: %f,  timer from the timer service  entity: %d\n",
+           timer->expiry,timer->entity);
+  time = timer->expiry;
+  if (recordfilename != NULL && timer != &fectimer)
+    logevent(LOG_SERVICE, timer->entity, 0, NULL, NULL);
+  PROFILE_CALL(PROF_TIMERSERVICE, timer->handler(timer->entity, timer->cookie));
+  PROFILE_COUNT(timersfired);
+}
+
+/* run the event loop until the event list is empty and no timer is running,
+   or until maxevents events have been processed (0 for no limit), returns
+   the number processed */
+long simulate(long maxevents)
+{
+  struct event *eventptr, *q;
+  struct timer *timer;
   struct msg  msg2give;
   struct pkt  pkt2give;
-   
+  double nexttime;
+  long nprocessed = 0;
   int i,j;
-  
-  init();
-  A_init();
-  B_init();
-   
-  while (1) {
+
+  while (maxevents == 0 || nprocessed < maxevents) {
     eventptr = evlist;            /* get next event to simulate */
-    if (eventptr==NULL)
-      goto terminate;
+    /* a timer from the timer service goes off first if it is due sooner */
+    timer = timer_due(eventptr != NULL ? eventptr->evtime : HUGE_VAL);
+    if (timer != NULL)
+      nexttime = timer->expiry;
+    else if (eventptr != NULL)
+      nexttime = eventptr->evtime;
+    else
+      break;
+    /* the state is unchanged between events, so take every sample that
+       falls due before this event with the current state */
+    if (sampleinterval > 0.0)
+      while (nextsample <= nexttime) {
+        takesample(nextsample);
+        nextsample += sampleinterval;
+      }
+    if (snapshottime >= 0.0 && nexttime > snapshottime) {
+      savesimulation(snapshotfilename);
+      snapshottime = -1.0;
+    }
+    if (timer != NULL) {
+      givetimer(timer);
+      nprocessed++;
+      continue;
+    }
     evlist = evlist->next;        /* remove this event from event list */
     if (evlist!=NULL)
       evlist->prev=NULL;
+    nevents--;
     if (TRACE>=2) {
       printf("\nEVENT time: %f,",eventptr->evtime);
       printf("  type: %d",eventptr->evtype);
@@ -420,6 +1249,19 @@ int main(void)
       printf(" entity: %d\n",eventptr->eventity);
     }
     time = eventptr->evtime;        /* update time to next event time */
+    if (eventptr->evtype >= TIMER_INTERRUPT && eventptr->evtype <= FROM_LAYER3)
+      PROFILE_COUNT(events[eventptr->evtype]);
+    if (eventptr->evtype == FROM_LAYER5 && nsim < nsimmax && atcap()
+        && (q = nextpacket()) != NULL) {
+      /* hold the arrival back until the next packet leaves the medium.
+         It goes in just after that packet, as insertevent puts an event
+         before any others due at the same time */
+      eventptr->evtime = nextafter(q->evtime, HUGE_VAL);
+      insertevent(eventptr);
+      nheld++;
+      nprocessed++;
+      continue;
+    }
     if (eventptr->evtype == FROM_LAYER5 ) {
       if (nsim < nsimmax) {
         generate_next_arrival();   /* set up future arrival */
@@ -427,52 +1269,171 @@ int main(void)
         j = nsim % 26; 
         for (i=0; i<20; i++)  
           msg2give.data[i] = 97 + j;
-        if (TRACE>2) {
-          printf("          MAINLOOP: data given to student: ");
-          for (i=0; i<20; i++) 
-            printf("%c", msg2give.data[i]);
-          printf("\n");
-        }
-        nsim++;
-        if (eventptr->eventity == A) 
-          A_output(msg2give);  
-        else
-          B_output(msg2give);  
+        givemessage(eventptr->eventity, &msg2give);
       }
       else if (TRACE > 2)
           printf("          FROM_LAYER5: no more messages to send: \n");
     }
     else if (eventptr->evtype ==  FROM_LAYER3) {
+      ninflight--;
+      if (!eventptr->damaged)
+        nintact--;
       pkt2give.seqnum = eventptr->pktptr->seqnum;
       pkt2give.acknum = eventptr->pktptr->acknum;
       pkt2give.checksum = eventptr->pktptr->checksum;
       for (i=0; i<20; i++)  
         pkt2give.payload[i] = eventptr->pktptr->payload[i];
-	    if (eventptr->eventity ==A)      /* deliver packet by calling */
-        A_input(pkt2give);            /* appropriate entity */
-      else
-        B_input(pkt2give);
-	    free(eventptr->pktptr);          /* free the memory for packet */
-    }
-    else if (eventptr->evtype ==  TIMER_INTERRUPT) {
-      if (eventptr->eventity == A) 
-        A_timerinterrupt();
-      else
-        B_timerinterrupt();
+      /* deliver packet by calling appropriate entity */
+      if (eventptr->eventity == A || fecblock == 0 || fec_decode(&pkt2give))
+        givepacket(eventptr->eventity, pkt2give);
     }
+    else if (eventptr->evtype ==  TIMER_INTERRUPT)
+      giveinterrupt(eventptr->eventity, nintact > 0);
     else  {
       printf("INTERNAL PANIC: unknown event type \n");
     }
-    free(eventptr);
+    freeevent(eventptr);
+    nprocessed++;
+  }
+  return nprocessed;
+}
+
+/* feed the protocol the inputs recorded in the open event log, without the
+   event list or random numbers, until the log ends or the protocol stops
+   sending what it sent when recorded.  Returns the number of inputs given */
+long replay(void)
+{
+  struct logrecord r;
+  struct timer *timer;
+  long nreplayed = 0;
+
+  replaying = 1;
+  while (!diverged && eventlog_read(&r)) {
+    if (sampleinterval > 0.0)
+      while (nextsample <= r.time) {
+        takesample(nextsample);
+        nextsample += sampleinterval;
+      }
+    if (TRACE>=2)
+      printf("\nREPLAY time: %f,  record: %d  entity: %d\n", r.time, r.type, r.entity);
+    time = r.time;
+    switch (r.type) {
+    case LOG_LAYER5:
+      PROFILE_COUNT(events[FROM_LAYER5]);
+      givemessage(r.entity, &r.msg);
+      break;
+    case LOG_LAYER3:
+      PROFILE_COUNT(events[FROM_LAYER3]);
+      givepacket(r.entity, r.pkt);
+      break;
+    case LOG_TIMER:
+      PROFILE_COUNT(events[TIMER_INTERRUPT]);
+      giveinterrupt(r.entity, r.intact);
+      break;
+    case LOG_SERVICE:
+      /* the protocol arms its timers again as it runs, so the one that
+         went off must be due now */
+      timer = timer_due(r.time);
+      if (timer == NULL || timer->expiry != r.time || timer->entity != r.entity)
+        diverge("none of its timers went off when one did in the recorded run");
+      else
+        givetimer(timer);
+      break;
+    default:
+      diverge("it did not send a packet the recorded run sent");
+      break;
+    }
+    nreplayed++;
   }
+  replaying = 0;
+  return nreplayed;
+}
+
+
+int main(int argc, char **argv)
+{
+  parseargs(argc, argv);
+  init();
+  A_init();
+  B_init();
+
+  if (verify)
+    verify_init();
+  if (restorefilename != NULL)
+    restoresimulation(restorefilename);
+  if (sampleinterval > 0.0 && sampler_open(samplefilename))
+  {
+    /* first sample is due at the first multiple of the interval not before now */
+    nextsample = sampleinterval * (long)(time / sampleinterval);
+    if (nextsample < time)
+      nextsample += sampleinterval;
+  }
+  else
+    sampleinterval = 0.0;
+
+  if (replayfilename != NULL) {
+    if (!eventlog_open(replayfilename))
+      exit(EXIT_FAILURE);
+    replay();
+  }
+  else {
+    if (recordfilename != NULL && !eventlog_create(recordfilename))
+      exit(EXIT_FAILURE);
+    simulate(0);
+  }
+  eventlog_close();
 
- terminate:
+  if (sampleinterval > 0.0) {
+    takesample(time);
+    sampler_close();
+  }
   printf(" Simulator terminated at time %f\n after attempting to send %d msgs from layer5\n",time,nsim);
   printf("number of messages dropped due to full window:  %d \n", window_full);
   printf("number of valid (not corrupt or duplicate) acknowledgements received at A:  %d \n", new_ACKs);
   printf("(note: a single acknowledgement may have acknowledged more than one packet - if cumulative acknowledgements are used)\n");
   printf("number of packet resends by A:  %d \n", packets_resent);
+  printf("number of timeouts at A:  %d, spurious (an intact packet was still in the medium):  %d \n",
+         packets_timeout, nspurious);
   printf("number of correct packets received at B:  %d \n", packets_received);
   printf("number of messages delivered to application:  %d \n", messages_delivered);
+  if (ndelays > 0) {
+    printf("average delay of a message from layer 5 at A to layer 5 at B:  %f \n", delaysum / ndelays);
+    printf("longest delay of a message from layer 5 at A to layer 5 at B:  %f \n", delaymax);
+    printf("median, 90th and 99th percentile delay of a message:  %.1f %.1f %.1f \n",
+           delaypercentile(0.5), delaypercentile(0.9), delaypercentile(0.99));
+  }
+  if (fecblock > 0)
+    fec_report();
+  if (verify)
+    verify_report();
+  if (eventcap > 0 || inflightcap > 0) {
+    printf("number of packets turned away at the caps:  %d, arrivals held back:  %d \n",
+           ncapped, nheld);
+    printf("peak resident memory:  %ld KB in %d event chunks \n", peakrss(), nchunks);
+  }
+  if (profilefilename != NULL && profile_open(profilefilename)) {
+    profile_row("sim_time", time);
+    profile_row("messages_generated", nsim);
+    profile_row("packets_to_layer3", ntolayer3);
+    profile_row("packets_lost", nlost);
+    profile_row("packets_corrupted", ncorrupt);
+    profile_row("packets_sent_by_A", packets_sent);
+    profile_row("packets_lost_from_A", packets_lost);
+    profile_row("packets_corrupted_from_A", packets_corrupt);
+    profile_row("packets_resent_by_A", packets_resent);
+    profile_row("timeouts_at_A", packets_timeout);
+    profile_row("spurious_timeouts_at_A", nspurious);
+    profile_row("acks_received_at_A", total_ACKs_received);
+    profile_row("new_acks_at_A", new_ACKs);
+    profile_row("packets_received_at_B", packets_received);
+    profile_row("messages_delivered", messages_delivered);
+    profile_row("window_full", window_full);
+    profile_row("packets_capped", ncapped);
+    profile_row("arrivals_held", nheld);
+    profile_row("event_chunks", nchunks);
+    profile_row("peak_rss_kb", peakrss());
+    profile_close();
+  }
+  teardown();
   return EXIT_SUCCESS;
 }
\ No newline at end of file
@@ -1,4 +1,14 @@
+/* the trace level.  Builds with TRACE_LEVEL at 0 or above fix it at    */
+/* that level, so every trace above it compiles to nothing; by default   */
+/* it is the TRACE variable, entered at run time.                        */
+#ifndef TRACE_LEVEL
+#define TRACE_LEVEL (-1)
+#endif
+#if TRACE_LEVEL < 0
 extern int TRACE;
+#else
+#define TRACE TRACE_LEVEL
+#endif
 
 /* statistics updated by GBN */
 extern int total_ACKs_received;
@@ -30,11 +40,45 @@ struct pkt {
 /* send to A or B (int), packet to send */
 extern void tolayer3(int, struct pkt);  
 
+/* send from A or B (int), an array of count (int) packets in order */
+extern void tolayer3_batch(int, struct pkt *, int);
+
 /* deliver to A or B (int), data to deliver */
 extern void tolayer5(int, char[20]); 
 
+/* deliver to A or B (int), a run of count (int) messages in order */
+extern void tolayer5_batch(int, struct msg *, int);
+
 /* start timer at A or B (int), increment */
 extern void starttimer(int, double);       
 
 /* stop timer at A or B (int) */
-extern void stoptimer(int);               
+extern void stoptimer(int);
+
+/* a timer from the timer service.  The protocol owns the storage, so an  */
+/* entity can run any number of them; the fields belong to the emulator. */
+/* A zeroed timer is stopped.                                             */
+struct timer {
+  double expiry;                            /* time the timer goes off */
+  int entity;                               /* A or B */
+  void (*handler)(int AorB, void *cookie);  /* called when it goes off */
+  void *cookie;                             /* handed back to the handler */
+  struct timer **slot;                      /* wheel slot holding it, NULL when stopped */
+  struct timer *prev;
+  struct timer *next;
+};
+
+/* (re)start timer at A or B (int) to call handler with cookie after increment */
+extern void settimer(struct timer *, int, double, void (*)(int, void *), void *);
+
+/* stop timer, nothing happens if it is not running */
+extern void canceltimer(struct timer *);
+
+/* time left before timer goes off, negative if it is not running */
+extern double timerremaining(struct timer *);
+
+/* the current simulated time */
+extern double simtime(void);
+
+/* random number uniform in [0,1], the emulator's only source of randomness */
+extern double jimsrand(void);               
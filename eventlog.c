@@ -0,0 +1,128 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "emulator.h"
+#include "eventlog.h"
+
+/* ******************************************************************
+   Binary event log.
+
+   A log starts with LOGMAGIC, followed by the records back to back.
+   Each record is a kind byte, an entity byte whose second bit is set
+   for a timer that went off with an intact packet in the medium, the
+   time, and then the message or packet if the kind carries one.  It
+   is written in the native byte order, like snapshots, so a log must
+   be replayed on the machine that recorded it.  The file is read and
+   written through a large stdio buffer, so logs of any length stream
+   through without being held in memory.
+**********************************************************************/
+
+#define LOGMAGIC    "SIMLOG01"   /* first bytes of every event log */
+#define LOGBUFSIZE  (1 << 20)    /* stdio buffer of the log file */
+
+static FILE *logfile = NULL;        /* the log being recorded or replayed */
+static const char *logname;         /* its file name, for messages */
+static int logwriting;              /* true if it is being recorded */
+
+/* size of the message or packet carried by a record of kind type, -1 if
+   there is no such kind */
+static int bodysize(int type)
+{
+  switch (type) {
+  case LOG_LAYER5:
+    return sizeof(struct msg);
+  case LOG_LAYER3:
+  case LOG_SEND:
+    return sizeof(struct pkt);
+  case LOG_TIMER:
+  case LOG_SERVICE:
+    return 0;
+  default:
+    return -1;
+  }
+}
+
+int eventlog_create(const char *filename)
+{
+  logfile = fopen(filename, "wb");
+  if (logfile == NULL) {
+    printf("unable to create event log %s\n", filename);
+    return 0;
+  }
+  setvbuf(logfile, NULL, _IOFBF, LOGBUFSIZE);
+  logname = filename;
+  logwriting = 1;
+  fwrite(LOGMAGIC, 1, 8, logfile);
+  return 1;
+}
+
+void eventlog_write(const struct logrecord *r)
+{
+  unsigned char head[2];
+
+  head[0] = r->type;
+  head[1] = r->entity | (r->intact ? 2 : 0);
+  fwrite(head, 1, 2, logfile);
+  fwrite(&r->time, sizeof(r->time), 1, logfile);
+  if (r->type == LOG_LAYER5)
+    fwrite(&r->msg, sizeof(r->msg), 1, logfile);
+  else if (bodysize(r->type) > 0)
+    fwrite(&r->pkt, sizeof(r->pkt), 1, logfile);
+}
+
+int eventlog_open(const char *filename)
+{
+  char magic[8];
+
+  logfile = fopen(filename, "rb");
+  if (logfile == NULL) {
+    printf("unable to open event log %s\n", filename);
+    return 0;
+  }
+  setvbuf(logfile, NULL, _IOFBF, LOGBUFSIZE);
+  logname = filename;
+  logwriting = 0;
+  if (fread(magic, 1, 8, logfile) != 8 || memcmp(magic, LOGMAGIC, 8) != 0) {
+    printf("event log %s is not a valid event log\n", filename);
+    fclose(logfile);
+    logfile = NULL;
+    return 0;
+  }
+  return 1;
+}
+
+int eventlog_read(struct logrecord *r)
+{
+  unsigned char head[2];
+  size_t got;
+  int size, ok;
+
+  got = fread(head, 1, 2, logfile);
+  if (got == 0)
+    return 0;            /* the end of the log */
+  ok = got == 2 && (size = bodysize(head[0])) >= 0;
+  if (ok) {
+    r->type = head[0];
+    r->entity = head[1] & 1;
+    r->intact = (head[1] & 2) != 0;
+    ok = fread(&r->time, sizeof(r->time), 1, logfile) == 1;
+  }
+  if (ok && r->type == LOG_LAYER5)
+    ok = fread(&r->msg, sizeof(r->msg), 1, logfile) == 1;
+  else if (ok && size > 0)
+    ok = fread(&r->pkt, sizeof(r->pkt), 1, logfile) == 1;
+  if (!ok) {
+    printf("Warning: event log %s is damaged or cut short, replay stops here.\n", logname);
+    return 0;
+  }
+  return 1;
+}
+
+void eventlog_close(void)
+{
+  if (logfile == NULL)
+    return;
+  if (fclose(logfile) != 0 && logwriting)
+    printf("Warning: unable to write event log %s\n", logname);
+  logfile = NULL;
+}
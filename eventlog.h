@@ -0,0 +1,36 @@
+/* Event log of everything the protocol entities are given: messages   */
+/* from layer 5, packets from layer 3 and timers going off, each with  */
+/* its time, and the packets the entities hand to layer 3 in return.   */
+/* Replaying a log gives the same inputs to the protocol again without */
+/* the random number generator or the event list, and the packets it   */
+/* sends show whether it still behaves as it did when recorded.         */
+
+#define LOG_LAYER5   1   /* message arrives from layer 5 */
+#define LOG_LAYER3   2   /* packet arrives from layer 3 */
+#define LOG_TIMER    3   /* starttimer() timer goes off */
+#define LOG_SERVICE  4   /* timer service timer goes off */
+#define LOG_SEND     5   /* packet the entity handed to layer 3 */
+
+struct logrecord {
+  int type;              /* one of the LOG_ kinds */
+  int entity;            /* A or B */
+  int intact;            /* LOG_TIMER: an intact packet was still in the medium */
+  double time;           /* simulated time of the record */
+  struct msg msg;        /* LOG_LAYER5 */
+  struct pkt pkt;        /* LOG_LAYER3 and LOG_SEND */
+};
+
+/* create the log file to record into, returns 0 on failure */
+extern int eventlog_create(const char *filename);
+
+/* append one record to the log being recorded */
+extern void eventlog_write(const struct logrecord *r);
+
+/* open a recorded log to replay, returns 0 on failure */
+extern int eventlog_open(const char *filename);
+
+/* read the next record of the log being replayed, 0 at the end of it */
+extern int eventlog_read(struct logrecord *r);
+
+/* finish the log being recorded or replayed, if any */
+extern void eventlog_close(void);
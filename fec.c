@@ -0,0 +1,190 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include "emulator.h"
+#include "fec.h"
+
+/* ******************************************************************
+   XOR parity forward error correction.
+
+   Both protocols leave the acknum of their data packets unused, so
+   the coder carries its header there: a marker bit, the block number
+   and the index of the packet in its block.  B strips the header
+   before the protocol sees the packet, so the protocol's checksum
+   still holds.  Packets with any other acknum pass through uncoded.
+
+   A parity packet holds the XOR of the seqnum, checksum and payload
+   of the data packets of its block, and its index is the number of
+   them.  The channel never reorders, so the parity packet is the last
+   of its block to arrive.  If exactly one data packet is missing by
+   then, XORing the parity packet with the ones received rebuilds it,
+   checksum included.  A corrupted packet in the block leaves a rebuilt
+   packet that fails the protocol's checksum like any other.
+
+   Payloads are XORed a 32 bit word at a time.
+**********************************************************************/
+
+#define UNCODED    (-1)        /* acknum of the data packets of both protocols */
+#define FECMARK    0x40000000  /* set in the acknum of every coded packet */
+#define FECPARITY  0x20000000  /* set in the acknum of parity packets */
+#define INDEXBITS  6           /* enough for FECMAXK */
+#define INDEXMASK  ((1 << INDEXBITS) - 1)
+#define BLOCKMASK  0x3fff      /* block numbers wrap round */
+
+#define PAYLOADWORDS (20 / sizeof(uint32_t))
+
+struct parity {
+  int seqnum;
+  int checksum;
+  uint32_t payload[PAYLOADWORDS];
+};
+
+static int blocksize;             /* data packets per block, 0 = coding off */
+
+static int sendblock;             /* number of the block open at A */
+static int sendcount;             /* data packets sent in it so far */
+static struct parity sendparity;  /* XOR of those packets */
+
+static int rcvblock;              /* number of the block arriving at B, -1 = none */
+static int rcvcount;              /* data packets of it received so far */
+static struct parity rcvparity;   /* XOR of those packets */
+
+/* coding statistics */
+static int nparity;      /* parity packets sent */
+static int nrebuilt;     /* lost packets rebuilt at B */
+static int nunrepaired;  /* blocks which lost more than one packet */
+
+/* XOR packet p into the parity acc */
+static void addparity(struct parity *acc, const struct pkt *p)
+{
+  uint32_t words[PAYLOADWORDS];
+  unsigned i;
+
+  memcpy(words, p->payload, sizeof(words));
+  for (i=0; i<PAYLOADWORDS; i++)
+    acc->payload[i] ^= words[i];
+  acc->seqnum ^= p->seqnum;
+  acc->checksum ^= p->checksum;
+}
+
+/* write the parity packet of the block open at A and open the next one */
+static void closeblock(struct pkt *parity)
+{
+  parity->seqnum = sendparity.seqnum;
+  parity->acknum = FECMARK | FECPARITY | (sendblock << INDEXBITS) | sendcount;
+  parity->checksum = sendparity.checksum;
+  memcpy(parity->payload, sendparity.payload, sizeof(parity->payload));
+  nparity++;
+
+  sendblock = (sendblock + 1) & BLOCKMASK;
+  sendcount = 0;
+  memset(&sendparity, 0, sizeof(sendparity));
+}
+
+void fec_init(int k)
+{
+  blocksize = k;
+  sendblock = 0;
+  sendcount = 0;
+  memset(&sendparity, 0, sizeof(sendparity));
+  rcvblock = -1;
+  rcvcount = 0;
+  memset(&rcvparity, 0, sizeof(rcvparity));
+  nparity = 0;
+  nrebuilt = 0;
+  nunrepaired = 0;
+}
+
+int fec_encode(const struct pkt *in, int count, struct pkt *out)
+{
+  int i, n = 0;
+
+  for (i=0; i<count; i++) {
+    out[n] = in[i];
+    if (blocksize == 0 || in[i].acknum != UNCODED) {
+      n++;
+      continue;
+    }
+    out[n++].acknum = FECMARK | (sendblock << INDEXBITS) | sendcount;
+    addparity(&sendparity, &in[i]);
+    if (++sendcount == blocksize)
+      closeblock(&out[n++]);
+  }
+  return n;
+}
+
+int fec_pending(void)
+{
+  return sendcount;
+}
+
+int fec_flush(struct pkt *parity)
+{
+  if (sendcount == 0)
+    return 0;
+  closeblock(parity);
+  return 1;
+}
+
+int fec_decode(struct pkt *packet)
+{
+  int tag = packet->acknum;
+  int block;
+
+  if (tag < 0 || !(tag & FECMARK))
+    return 1;                      /* uncoded, or its header was corrupted */
+
+  block = (tag >> INDEXBITS) & BLOCKMASK;
+  if (block != rcvblock) {
+    rcvblock = block;
+    rcvcount = 0;
+    memset(&rcvparity, 0, sizeof(rcvparity));
+  }
+
+  if (!(tag & FECPARITY)) {
+    packet->acknum = UNCODED;
+    addparity(&rcvparity, packet);
+    rcvcount++;
+    return 1;
+  }
+
+  /* the index of a parity packet is the number of data packets in its block */
+  if (rcvcount != (tag & INDEXMASK) - 1) {
+    if (rcvcount < (tag & INDEXMASK) - 1)
+      nunrepaired++;
+    return 0;
+  }
+  addparity(&rcvparity, packet);
+  packet->seqnum = rcvparity.seqnum;
+  packet->acknum = UNCODED;
+  packet->checksum = rcvparity.checksum;
+  memcpy(packet->payload, rcvparity.payload, sizeof(packet->payload));
+  rcvcount++;
+  nrebuilt++;
+  return 1;
+}
+
+#define SAVE(x) (fwrite(&(x), sizeof(x), 1, fp) == 1)
+#define LOAD(x) (fread(&(x), sizeof(x), 1, fp) == 1)
+
+int fec_save(FILE *fp)
+{
+  return SAVE(blocksize) && SAVE(sendblock) && SAVE(sendcount) && SAVE(sendparity)
+    && SAVE(rcvblock) && SAVE(rcvcount) && SAVE(rcvparity)
+    && SAVE(nparity) && SAVE(nrebuilt) && SAVE(nunrepaired);
+}
+
+int fec_restore(FILE *fp)
+{
+  return LOAD(blocksize) && LOAD(sendblock) && LOAD(sendcount) && LOAD(sendparity)
+    && LOAD(rcvblock) && LOAD(rcvcount) && LOAD(rcvparity)
+    && LOAD(nparity) && LOAD(nrebuilt) && LOAD(nunrepaired);
+}
+
+void fec_report(void)
+{
+  printf("FEC: parity packets sent:  %d \n", nparity);
+  printf("FEC: lost packets rebuilt at B:  %d \n", nrebuilt);
+  printf("FEC: blocks which lost too many packets to rebuild:  %d \n", nunrepaired);
+}
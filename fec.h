@@ -0,0 +1,31 @@
+/* forward error correction between the transport layer at A and layer 3. */
+/* Every k data packets A sends are followed by an XOR parity packet, from */
+/* which B rebuilds a single packet lost from the block.                   */
+
+#define FECMAXK 63     /* largest block size */
+
+/* start with empty blocks of k data packets, 0 turns the coding off */
+extern void fec_init(int k);
+
+/* tag count packets from A for the receiver and append the parity packet
+   of each block completed.  out needs room for count + count/k + 1 packets.
+   Returns the number of packets placed in out. */
+extern int fec_encode(const struct pkt *in, int count, struct pkt *out);
+
+/* number of data packets in the block still open at A */
+extern int fec_pending(void);
+
+/* close the open block early by writing its parity packet, 0 if it is empty */
+extern int fec_flush(struct pkt *parity);
+
+/* undo the coding of a packet arriving at B.  Data packets are handed
+   back untagged, and a parity packet is replaced by the packet it
+   rebuilds.  Returns 0 if there is nothing to give to B. */
+extern int fec_decode(struct pkt *packet);
+
+/* write and read back the coder state for simulation snapshots, 0 on failure */
+extern int fec_save(FILE *fp);
+extern int fec_restore(FILE *fp);
+
+/* print the coding statistics */
+extern void fec_report(void);
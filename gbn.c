@@ -3,6 +3,7 @@
 #include <stdbool.h>
 #include "emulator.h"
 #include "gbn.h"
+#include "seq.h"
 
 /* ******************************************************************
    Go Back N protocol.  Adapted from J.F.Kurose
@@ -20,13 +21,42 @@
    - removed bidirectional GBN code and other code not used by prac. 
    - fixed C style to adhere to current programming style
    - added GBN implementation
+   - added optional selective ACKs (SACK): B buffers out of order packets
+     inside its window and A does not resend the ones B reports buffered
+   - sequence numbers are 32 bit serial numbers (see seq.h) instead of
+     counting modulo a small sequence space
+   - added optional pacing (PACING): A sends the packets of its window one
+     at a time, spaced by a smoothed round trip estimate divided by the
+     window size, instead of in bursts after each timeout
 **********************************************************************/
 
+#ifndef SACK
+#define SACK 0          /* 1 = buffer out of order packets at B and ACK them selectively */
+#endif
+
+#ifndef PACING
+#define PACING 0        /* 1 = spread A's transmissions evenly over the estimated round trip */
+#endif
+
+/* the protocol constants can be fixed by the build, e.g. -DWINDOWSIZE=12 -DRINGSIZE=16 */
+#ifndef RTT
 #define RTT  16.0       /* round trip time.  MUST BE SET TO 16.0 when submitting assignment */
+#endif
+#ifndef WINDOWSIZE
 #define WINDOWSIZE 6    /* the maximum number of buffered unacked packet */
-#define SEQSPACE 7      /* the min sequence space for GBN must be at least windowsize + 1 */
+#endif
+#ifndef RINGSIZE
+#define RINGSIZE 8      /* window slots, a power of 2 not below WINDOWSIZE */
+#endif
 #define NOTINUSE (-1)   /* used to fill header fields that are not being used */
 
+#if (RINGSIZE & (RINGSIZE - 1)) != 0 || RINGSIZE < WINDOWSIZE
+#error RINGSIZE must be a power of 2 and at least WINDOWSIZE
+#endif
+#if SACK && WINDOWSIZE > 20
+#error selective ACKs mark the window in the 20 byte payload, WINDOWSIZE must be at most 20
+#endif
+
 /* generic procedure to compute the checksum of a packet.  Used by both sender and receiver  
    the simulator will overwrite part of your packet with 'z's.  It will not overwrite your 
    original checksum.  This procedure must generate a different checksum to the original if
@@ -34,15 +64,15 @@
 */
 int ComputeChecksum(struct pkt packet)
 {
-  int checksum = 0;
+  unsigned checksum = 0;  /* sequence numbers use all 32 bits, so the sum wraps */
   int i;
 
-  checksum = packet.seqnum;
-  checksum += packet.acknum;
+  checksum = (unsigned)packet.seqnum;
+  checksum += (unsigned)packet.acknum;
   for ( i=0; i<20; i++ ) 
-    checksum += (int)(packet.payload[i]);
+    checksum += (unsigned)(packet.payload[i]);
 
-  return checksum;
+  return (int)checksum;
 }
 
 bool IsCorrupted(struct pkt packet)
@@ -56,10 +86,61 @@ bool IsCorrupted(struct pkt packet)
 
 /********* Sender (A) variables and functions ************/
 
-static struct pkt buffer[WINDOWSIZE];  /* array for storing packets waiting for ACK */
-static int windowfirst, windowlast;    /* array indexes of the first/last packet awaiting ACK */
+static struct pkt buffer[RINGSIZE];    /* packets waiting for ACK, in the slot of their seqnum */
+static seq_t windowfirst;              /* sequence number of the first packet awaiting ACK */
 static int windowcount;                /* the number of packets currently awaiting an ACK */
-static int A_nextseqnum;               /* the next sequence number to be used by the sender */
+static seq_t A_nextseqnum;             /* the next sequence number to be used by the sender */
+#if SACK
+static bool sacked[RINGSIZE];          /* packets in the window B reported buffered */
+#endif
+#if PACING
+static int windowsent;                 /* packets at the front of the window handed to layer 3 */
+static double sendtime[RINGSIZE];      /* when each packet was last sent, negative if never */
+static bool resent[RINGSIZE];          /* sent more than once, so its ACK is not timed */
+static double srtt;                    /* smoothed round trip time */
+static struct timer pacetimer;         /* running until the next packet may be sent */
+
+/* hand the next packet waiting in the window to layer 3, false if none is */
+static bool sendnext(void)
+{
+  int slot;
+
+  while (windowsent < windowcount) {
+    slot = SEQ_SLOT(windowfirst + windowsent, RINGSIZE);
+    windowsent++;
+#if SACK
+    /* B already holds this one, but it always waits for the first */
+    if (windowsent > 1 && sacked[slot])
+      continue;
+#endif
+    if (sendtime[slot] >= 0.0) {
+      packets_resent++;
+      resent[slot] = true;
+    }
+    sendtime[slot] = simtime();
+    if (TRACE > 0)
+      printf("Sending packet %d to layer 3\n", buffer[slot].seqnum);
+    tolayer3 (A, buffer[slot]);
+    return true;
+  }
+  return false;
+}
+
+/* the pacing interval is over: send the next packet and wait again */
+static void A_pace(int AorB, void *cookie)
+{
+  (void)cookie;
+  if (sendnext())
+    settimer(&pacetimer, AorB, srtt / WINDOWSIZE, A_pace, NULL);
+}
+
+/* send at once unless the last packet went too recently, when the pace timer will */
+static void startpacing(void)
+{
+  if (timerremaining(&pacetimer) < 0.0)
+    A_pace(A, NULL);
+}
+#endif
 
 /* called from layer 5 (application layer), passed the message to be sent to other side */
 void A_output(struct msg message)
@@ -80,22 +161,30 @@ void A_output(struct msg message)
     sendpkt.checksum = ComputeChecksum(sendpkt); 
 
     /* put packet in window buffer */
-    /* windowlast will always be 0 for alternating bit; but not for GoBackN */
-    windowlast = (windowlast + 1) % WINDOWSIZE; 
-    buffer[windowlast] = sendpkt;
+    buffer[SEQ_SLOT(A_nextseqnum, RINGSIZE)] = sendpkt;
+#if SACK
+    sacked[SEQ_SLOT(A_nextseqnum, RINGSIZE)] = false;
+#endif
     windowcount++;
 
+#if PACING
+    /* queue it behind the packets still waiting for their turn */
+    sendtime[SEQ_SLOT(A_nextseqnum, RINGSIZE)] = -1.0;
+    resent[SEQ_SLOT(A_nextseqnum, RINGSIZE)] = false;
+    startpacing();
+#else
     /* send out packet */
     if (TRACE > 0)
       printf("Sending packet %d to layer 3\n", sendpkt.seqnum);
     tolayer3 (A, sendpkt);
+#endif
 
     /* start timer if first packet in window */
     if (windowcount == 1)
       starttimer(A,RTT);
 
-    /* get next sequence number, wrap back to 0 */
-    A_nextseqnum = (A_nextseqnum + 1) % SEQSPACE;  
+    /* get next sequence number */
+    A_nextseqnum++;
   }
   /* if blocked,  window is full */
   else {
@@ -112,7 +201,12 @@ void A_output(struct msg message)
 void A_input(struct pkt packet)
 {
   int ackcount = 0;
+#if SACK
   int i;
+#endif
+#if PACING
+  int slot;
+#endif
 
   /* if received ACK is not corrupted */ 
   if (!IsCorrupted(packet)) {
@@ -120,42 +214,47 @@ void A_input(struct pkt packet)
       printf("----A: uncorrupted ACK %d is received\n",packet.acknum);
     total_ACKs_received++;
 
-    /* check if new ACK or duplicate */
-    if (windowcount != 0) {
-          int seqfirst = buffer[windowfirst].seqnum;
-          int seqlast = buffer[windowlast].seqnum;
-          /* check case when seqnum has and hasn't wrapped */
-          if (((seqfirst <= seqlast) && (packet.acknum >= seqfirst && packet.acknum <= seqlast)) ||
-              ((seqfirst > seqlast) && (packet.acknum >= seqfirst || packet.acknum <= seqlast))) {
-
-            /* packet is a new ACK */
-            if (TRACE > 0)
-              printf("----A: ACK %d is not a duplicate\n",packet.acknum);
-            new_ACKs++;
-
-            /* cumulative acknowledgement - determine how many packets are ACKed */
-            if (packet.acknum >= seqfirst)
-              ackcount = packet.acknum + 1 - seqfirst;
-            else
-              ackcount = SEQSPACE - seqfirst + packet.acknum;
-
-	    /* slide window by the number of packets ACKed */
-            windowfirst = (windowfirst + ackcount) % WINDOWSIZE;
-
-            /* delete the acked packets from window buffer */
-            for (i=0; i<ackcount; i++)
-              windowcount--;
-
-	    /* start timer again if there are still more unacked packets in window */
-            stoptimer(A);
-            if (windowcount > 0)
-              starttimer(A, RTT);
-
-          }
-        }
-        else
-          if (TRACE > 0)
+    /* check if new ACK or duplicate: new ACKs are for a packet in the window */
+    if (SEQ_INWINDOW(packet.acknum, windowfirst, windowcount)) {
+
+      /* packet is a new ACK */
+      if (TRACE > 0)
+        printf("----A: ACK %d is not a duplicate\n",packet.acknum);
+      new_ACKs++;
+
+      /* cumulative acknowledgement - determine how many packets are ACKed */
+      ackcount = SEQ_DIFF(packet.acknum, windowfirst) + 1;
+
+#if PACING
+      /* time the round trip of the ACKed packet unless it was resent,
+         when the ACK could be for either copy (Karn's rule) */
+      slot = SEQ_SLOT(packet.acknum, RINGSIZE);
+      if (!resent[slot] && sendtime[slot] >= 0.0)
+        srtt += (simtime() - sendtime[slot] - srtt) / 8;
+      windowsent = windowsent > ackcount ? windowsent - ackcount : 0;
+#endif
+
+      /* slide window by the number of packets ACKed */
+      windowfirst += ackcount;
+      windowcount -= ackcount;
+
+      /* start timer again if there are still more unacked packets in window */
+      stoptimer(A);
+      if (windowcount > 0)
+        starttimer(A, RTT);
+    }
+    else
+      if (TRACE > 0)
         printf ("----A: duplicate ACK received, do nothing!\n");
+
+#if SACK
+    /* selective part of the ACK: payload[i] is '1' when B has buffered the
+       packet i places after the one it is waiting for */
+    if (windowcount != 0 && (seq_t)packet.acknum + 1 == windowfirst)
+      for (i=1; i<windowcount; i++)
+        if (packet.payload[i] == '1')
+          sacked[SEQ_SLOT(windowfirst + i, RINGSIZE)] = true;
+#endif
   }
   else 
     if (TRACE > 0)
@@ -165,21 +264,46 @@ void A_input(struct pkt packet)
 /* called when A's timer goes off */
 void A_timerinterrupt(void)
 {
+#if PACING
+  if (TRACE > 0)
+    printf("----A: time out,resend packets!\n");
+
+  /* go back to the start of the window and let the pacer resend it */
+  windowsent = 0;
+  if (windowcount > 0) {
+    startpacing();
+    starttimer(A,RTT);
+  }
+#else
+  struct pkt resend[WINDOWSIZE];
+  int count = 0;
   int i;
 
   if (TRACE > 0)
     printf("----A: time out,resend packets!\n");
 
+  /* collect the window in order and hand it to layer 3 in one batch */
   for(i=0; i<windowcount; i++) {
 
+#if SACK
+    /* B already holds this one, only the gaps need resending.  B is always
+       waiting for the first packet, so that one is always resent */
+    if (i > 0 && sacked[SEQ_SLOT(windowfirst + i, RINGSIZE)])
+      continue;
+#endif
     if (TRACE > 0)
-      printf ("---A: resending packet %d\n", (buffer[(windowfirst+i) % WINDOWSIZE]).seqnum);
+      printf ("---A: resending packet %d\n", buffer[SEQ_SLOT(windowfirst + i, RINGSIZE)].seqnum);
 
-    tolayer3(A,buffer[(windowfirst+i) % WINDOWSIZE]);
-    packets_resent++;
-    if (i==0) starttimer(A,RTT);
+    resend[count++] = buffer[SEQ_SLOT(windowfirst + i, RINGSIZE)];
   }
-}       
+
+  if (count > 0) {
+    tolayer3_batch(A, resend, count);
+    packets_resent += count;
+    starttimer(A,RTT);
+  }
+#endif
+}
 
 
 
@@ -190,19 +314,30 @@ void A_init(void)
   /* initialise A's window, buffer and sequence number */
   A_nextseqnum = 0;  /* A starts with seq num 0, do not change this */
   windowfirst = 0;
-  windowlast = -1;   /* windowlast is where the last packet sent is stored.  
-		     new packets are placed in winlast + 1 
-		     so initially this is set to -1
-		   */
   windowcount = 0;
+#if PACING
+  windowsent = 0;
+  srtt = RTT;  /* until the first ACK is timed */
+  canceltimer(&pacetimer);
+#endif
+}
+
+/* number of packets in A's window still awaiting an ACK */
+int A_windowcount(void)
+{
+  return windowcount;
 }
 
 
 
 /********* Receiver (B)  variables and procedures ************/
 
-static int expectedseqnum; /* the sequence number expected next by the receiver */
-static int B_nextseqnum;   /* the sequence number for the next packets sent by B */
+static seq_t expectedseqnum; /* the sequence number expected next by the receiver */
+static int B_nextseqnum;     /* the sequence number for the next packets sent by B */
+#if SACK
+static bool received[RINGSIZE];       /* which slots of the window B holds out of order */
+static struct msg rcvbuf[RINGSIZE];   /* out of order packets, in the slot of their seqnum */
+#endif
 
 
 /* called from layer 3, when a packet arrives for layer 4 at B*/
@@ -212,7 +347,7 @@ void B_input(struct pkt packet)
   int i;
 
   /* if not corrupted and received packet is in order */
-  if  ( (!IsCorrupted(packet))  && (packet.seqnum == expectedseqnum) ) {
+  if  ( (!IsCorrupted(packet))  && ((seq_t)packet.seqnum == expectedseqnum) ) {
     if (TRACE > 0)
       printf("----B: packet %d is correctly received, send ACK!\n",packet.seqnum);
     packets_received++;
@@ -224,16 +359,40 @@ void B_input(struct pkt packet)
     sendpkt.acknum = expectedseqnum;
 
     /* update state variables */
-    expectedseqnum = (expectedseqnum + 1) % SEQSPACE;        
+    expectedseqnum++;
+
+#if SACK
+    /* the packet may have filled a gap: deliver the buffered run behind it
+       and ACK the last of them */
+    while (received[SEQ_SLOT(expectedseqnum, RINGSIZE)]) {
+      tolayer5(B, rcvbuf[SEQ_SLOT(expectedseqnum, RINGSIZE)].data);
+      received[SEQ_SLOT(expectedseqnum, RINGSIZE)] = false;
+      sendpkt.acknum = expectedseqnum;
+      expectedseqnum++;
+    }
+#endif
+  }
+#if SACK
+  else if ( (!IsCorrupted(packet)) &&
+            SEQ_INWINDOW(packet.seqnum, expectedseqnum, WINDOWSIZE) ) {
+    /* out of order but inside the receive window: keep it, ACK the in order part */
+    if (TRACE > 0)
+      printf("----B: packet %d is out of order, buffer it and resend ACK!\n",packet.seqnum);
+    if (!received[SEQ_SLOT(packet.seqnum, RINGSIZE)]) {
+      packets_received++;
+      received[SEQ_SLOT(packet.seqnum, RINGSIZE)] = true;
+      for ( i=0; i<20 ; i++ )
+        rcvbuf[SEQ_SLOT(packet.seqnum, RINGSIZE)].data[i] = packet.payload[i];
+    }
+    sendpkt.acknum = expectedseqnum - 1;
   }
+#endif
   else {
-    /* packet is corrupted or out of order resend last ACK */
+    /* packet is corrupted or out of order resend last ACK, which before
+       the first packet is the serial number just below 0 */
     if (TRACE > 0) 
       printf("----B: packet corrupted or not expected sequence number, resend ACK!\n");
-    if (expectedseqnum == 0)
-      sendpkt.acknum = SEQSPACE - 1;
-    else
-      sendpkt.acknum = expectedseqnum - 1;
+    sendpkt.acknum = expectedseqnum - 1;
   }
 
   /* create packet */
@@ -243,6 +402,12 @@ void B_input(struct pkt packet)
   /* we don't have any data to send.  fill payload with 0's */
   for ( i=0; i<20 ; i++ ) 
     sendpkt.payload[i] = '0';  
+#if SACK
+  /* mark the packets held after the gap, for A's selective resend */
+  for ( i=1; i<WINDOWSIZE ; i++ )
+    if (received[SEQ_SLOT(expectedseqnum + i, RINGSIZE)])
+      sendpkt.payload[i] = '1';
+#endif
 
   /* computer checksum */
   sendpkt.checksum = ComputeChecksum(sendpkt); 
@@ -255,10 +420,97 @@ void B_input(struct pkt packet)
 /* entity B routines are called. You can use it to do any initialization */
 void B_init(void)
 {
+#if SACK
+  int i;
+
+  for (i=0; i<RINGSIZE; i++)
+    received[i] = false;
+#endif
   expectedseqnum = 0;
   B_nextseqnum = 1;
 }
 
+/* number of out of order packets held by B, only ever non zero with SACK */
+int B_buffercount(void)
+{
+  int count = 0;
+#if SACK
+  int i;
+
+  for (i=0; i<RINGSIZE; i++)
+    if (received[i])
+      count++;
+#endif
+  return count;
+}
+
+/******************************************************************************
+ * Snapshot support: the whole protocol state, in a fixed order              *
+ *****************************************************************************/
+
+#define SAVE(x) (fwrite(&(x), sizeof(x), 1, fp) == 1)
+#define LOAD(x) (fread(&(x), sizeof(x), 1, fp) == 1)
+
+int save_protocol(FILE *fp)
+{
+#if PACING
+  /* the pace timer is saved as the time it has left, negative if stopped */
+  double pacewait = timerremaining(&pacetimer);
+
+  if (!(SAVE(pacewait) && SAVE(windowsent) && SAVE(sendtime) && SAVE(resent) && SAVE(srtt)))
+    return 0;
+#endif
+  return SAVE(buffer) && SAVE(windowfirst) && SAVE(windowcount)
+    && SAVE(A_nextseqnum) && SAVE(expectedseqnum) && SAVE(B_nextseqnum)
+#if SACK
+    && SAVE(sacked) && SAVE(received) && SAVE(rcvbuf)
+#endif
+    ;
+}
+
+int restore_protocol(FILE *fp)
+{
+#if PACING
+  double pacewait;
+
+  if (!(LOAD(pacewait) && LOAD(windowsent) && LOAD(sendtime) && LOAD(resent) && LOAD(srtt)))
+    return 0;
+  canceltimer(&pacetimer);
+  if (pacewait >= 0.0)
+    settimer(&pacetimer, A, pacewait, A_pace, NULL);
+#endif
+  return LOAD(buffer) && LOAD(windowfirst) && LOAD(windowcount)
+    && LOAD(A_nextseqnum) && LOAD(expectedseqnum) && LOAD(B_nextseqnum)
+#if SACK
+    && LOAD(sacked) && LOAD(received) && LOAD(rcvbuf)
+#endif
+    ;
+}
+
+/* the protocol and its build options, which a snapshot must match */
+const char *protocol_config(void)
+{
+  static char config[96];
+
+  sprintf(config, "gbn sack=%d pacing=%d window=%d ring=%d rtt=%g",
+          SACK, PACING, WINDOWSIZE, RINGSIZE, RTT);
+  return config;
+}
+
+/* bytes of state save_protocol writes */
+long protocol_statesize(void)
+{
+  return sizeof(buffer) + sizeof(windowfirst) + sizeof(windowcount)
+    + sizeof(A_nextseqnum) + sizeof(expectedseqnum) + sizeof(B_nextseqnum)
+#if SACK
+    + sizeof(sacked) + sizeof(received) + sizeof(rcvbuf)
+#endif
+#if PACING
+    + sizeof(double) + sizeof(windowsent) + sizeof(sendtime) + sizeof(resent) + sizeof(srtt)
+#endif
+    ;
+}
+
 /******************************************************************************
  * The following functions need be completed only for bi-directional messages *
  *****************************************************************************/
@@ -0,0 +1,87 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "profile.h"
+
+/* ******************************************************************
+   Profiling counters.
+
+   The counters live in one global structure which the emulator bumps
+   through the macros in profile.h.  At the end of a run they are
+   written, with any counters the emulator adds of its own, as CSV
+   rows of counter,value.
+**********************************************************************/
+
+struct profile profile;
+
+static FILE *profilefile = NULL;   /* file the profile is written to */
+
+#if PROFILE && PROFILE_CYCLES
+static const char *handlernames[PROF_HANDLERS] = {
+  "A_output", "A_input", "B_input", "A_timerinterrupt", "B_timerinterrupt",
+  "timerservice", "tolayer3"
+};
+#endif
+
+void profile_reset(void)
+{
+  memset(&profile, 0, sizeof(profile));
+}
+
+int profile_open(const char *filename)
+{
+  profilefile = fopen(filename, "w");
+  if (profilefile == NULL) {
+    printf("Warning: unable to open profile file %s\n", filename);
+    return 0;
+  }
+  fprintf(profilefile, "counter,value\n");
+  return 1;
+}
+
+void profile_row(const char *counter, double value)
+{
+  if (profilefile != NULL)
+    fprintf(profilefile, "%s,%.17g\n", counter, value);
+}
+
+void profile_close(void)
+{
+#if PROFILE && PROFILE_CYCLES
+  char name[64];
+  int h;
+#endif
+
+  if (profilefile == NULL)
+    return;
+#if PROFILE
+  profile_row("events_timer_interrupt", profile.events[0]);
+  profile_row("events_from_layer5", profile.events[1]);
+  profile_row("events_from_layer3", profile.events[2]);
+  profile_row("events_timer_service", profile.timersfired);
+  profile_row("evlist_high_water", profile.evlisthigh);
+  profile_row("insertevent_calls", profile.inserts);
+  profile_row("insertevent_scan_steps", profile.insertscan);
+  profile_row("starttimer_calls", profile.timerstarts);
+  profile_row("starttimer_scan_steps", profile.timerstartscan);
+  profile_row("starttimer_rejected", profile.timersrejected);
+  profile_row("stoptimer_calls", profile.timerstops);
+  profile_row("stoptimer_scan_steps", profile.timerstopscan);
+  profile_row("tolayer3_calls", profile.sends);
+  profile_row("tolayer3_scan_steps", profile.sendscan);
+  profile_row("settimer_calls", profile.settimers);
+  profile_row("settimer_rearms", profile.rearms);
+  profile_row("canceltimer_cancels", profile.cancels);
+#endif
+#if PROFILE && PROFILE_CYCLES
+  for (h=0; h<PROF_HANDLERS; h++) {
+    sprintf(name, "handler_%s_calls", handlernames[h]);
+    profile_row(name, profile.calls[h]);
+    sprintf(name, "handler_%s_cycles", handlernames[h]);
+    profile_row(name, (double)profile.cycles[h]);
+  }
+#endif
+  if (fclose(profilefile) != 0)
+    printf("Warning: unable to write profile.\n");
+  profilefile = NULL;
+}
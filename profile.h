@@ -0,0 +1,83 @@
+/* Profiling counters for the emulator's scheduler and the protocol      */
+/* handlers.  They are bumped through the macros below, so a build with  */
+/* PROFILE 0 compiles every one of them out.  PROFILE_CYCLES 1 also      */
+/* counts time stamp counter cycles in each handler, on x86 only.        */
+/* The counters cover the work done by this process, so they are not     */
+/* part of snapshots and a restored run counts from zero.                */
+
+#ifndef PROFILE
+#define PROFILE 1          /* 0 = no profiling counters */
+#endif
+#ifndef PROFILE_CYCLES
+#define PROFILE_CYCLES 0   /* 1 = also count cycles spent in each handler */
+#endif
+
+/* the handlers timed with PROFILE_CYCLES.  Times are inclusive, so the
+   cycles of a tolayer3 call made by A_output are in both */
+#define PROF_A_OUTPUT      0
+#define PROF_A_INPUT       1
+#define PROF_B_INPUT       2
+#define PROF_A_TIMER       3
+#define PROF_B_TIMER       4
+#define PROF_TIMERSERVICE  5
+#define PROF_TOLAYER3      6
+#define PROF_HANDLERS      7
+
+struct profile {
+  long events[3];          /* events processed, by type */
+  long timersfired;        /* timer service timers gone off */
+  int evlisthigh;          /* most events ever waiting on the event list */
+  long inserts;            /* insertevent calls */
+  long insertscan;         /* event list entries they stepped over */
+  long timerstarts;        /* starttimer calls */
+  long timerstartscan;     /* event list entries they stepped over */
+  long timerstops;         /* stoptimer calls */
+  long timerstopscan;      /* event list entries they stepped over */
+  long timersrejected;     /* starttimer calls rejected, the timer was already running */
+  long sends;              /* tolayer3 and tolayer3_batch calls reaching the medium */
+  long sendscan;           /* event list entries they stepped over */
+  long settimers;          /* settimer calls */
+  long rearms;             /* settimer calls on a timer already running */
+  long cancels;            /* canceltimer calls that stopped a running timer */
+  long calls[PROF_HANDLERS];                 /* handler calls timed */
+  unsigned long long cycles[PROF_HANDLERS];  /* cycles spent in them */
+};
+
+extern struct profile profile;
+
+#if PROFILE
+#define PROFILE_COUNT(counter)       (profile.counter++)
+#define PROFILE_HIGH(counter, value) \
+  do { if ((value) > profile.counter) profile.counter = (value); } while (0)
+#else
+#define PROFILE_COUNT(counter)       ((void)0)
+#define PROFILE_HIGH(counter, value) ((void)0)
+#endif
+
+/* make a handler call, counting its cycles when they are profiled */
+#if PROFILE && PROFILE_CYCLES
+#if !defined(__x86_64__) && !defined(__i386__)
+#error PROFILE_CYCLES needs the x86 time stamp counter
+#endif
+#include <x86intrin.h>
+#define PROFILE_CALL(handler, call) \
+  do { unsigned long long profstart_ = __rdtsc(); \
+       call; \
+       profile.cycles[handler] += __rdtsc() - profstart_; \
+       profile.calls[handler]++; } while (0)
+#else
+#define PROFILE_CALL(handler, call)  do { call; } while (0)
+#endif
+
+/* clear every counter */
+extern void profile_reset(void);
+
+/* open the profile file, returns 0 on failure.  It is written as CSV
+   rows of counter,value */
+extern int profile_open(const char *filename);
+
+/* add a counter kept outside the profile to the profile file */
+extern void profile_row(const char *counter, double value);
+
+/* write the profile counters after the rows added and close the file */
+extern void profile_close(void);
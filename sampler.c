@@ -0,0 +1,67 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include "sampler.h"
+
+/* ******************************************************************
+   Time-series metrics sampler.
+
+   Samples are formatted as CSV rows into a fixed size output buffer
+   which is written to the sample file whenever it fills up, so memory
+   use stays the same no matter how long the simulation runs.
+**********************************************************************/
+
+#define SAMPLEBUFSIZE 65536  /* size of the output buffer in bytes */
+#define MAXROWSIZE    256    /* upper bound on the length of one row */
+
+static FILE *samplefile = NULL;        /* file the samples are streamed to */
+static char samplebuf[SAMPLEBUFSIZE];  /* rows waiting to be written */
+static int samplebuflen;               /* number of bytes used in samplebuf */
+
+static void sampler_flush(void)
+{
+  if (samplebuflen > 0) {
+    if (fwrite(samplebuf, 1, samplebuflen, samplefile) != (size_t)samplebuflen)
+      printf("Warning: unable to write samples.\n");
+    samplebuflen = 0;
+  }
+}
+
+int sampler_open(const char *filename)
+{
+  samplefile = fopen(filename, "w");
+  if (samplefile == NULL) {
+    printf("Warning: unable to open sample file %s\n", filename);
+    return 0;
+  }
+  /* rows are already buffered here, so stdio does not need to */
+  setvbuf(samplefile, NULL, _IONBF, 0);
+  samplebuflen = sprintf(samplebuf,
+                         "time,nsim,windowcount,bufcount,inflight,evcount,"
+                         "ntolayer3,nlost,ncorrupt,window_full,packets_resent,"
+                         "new_ACKs,packets_received,messages_delivered\n");
+  return 1;
+}
+
+void sampler_write(const struct sample *s)
+{
+  if (samplefile == NULL)
+    return;
+  if (samplebuflen + MAXROWSIZE > SAMPLEBUFSIZE)
+    sampler_flush();
+  samplebuflen += sprintf(samplebuf + samplebuflen,
+                          "%.3f,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d\n",
+                          s->time, s->nsim, s->windowcount, s->bufcount,
+                          s->inflight, s->evcount, s->ntolayer3, s->nlost,
+                          s->ncorrupt, s->window_full, s->packets_resent,
+                          s->new_ACKs, s->packets_received,
+                          s->messages_delivered);
+}
+
+void sampler_close(void)
+{
+  if (samplefile == NULL)
+    return;
+  sampler_flush();
+  fclose(samplefile);
+  samplefile = NULL;
+}
@@ -0,0 +1,27 @@
+/* a "sample" is a snapshot of the simulator state taken every sample  */
+/* interval of simulated time.  Counters are cumulative since time 0.  */
+struct sample {
+  double time;             /* simulated time of the sample */
+  int nsim;                /* messages generated by layer 5 so far */
+  int windowcount;         /* packets awaiting an ACK in A's window */
+  int bufcount;            /* packets buffered in B's receive buffer */
+  int inflight;            /* packets currently in the medium */
+  int evcount;             /* events pending on the event list */
+  int ntolayer3;           /* packets handed to layer 3 */
+  int nlost;               /* packets lost in the medium */
+  int ncorrupt;            /* packets corrupted in the medium */
+  int window_full;         /* messages dropped due to full window */
+  int packets_resent;      /* packets resent by A */
+  int new_ACKs;            /* new ACKs received by A */
+  int packets_received;    /* correct packets received by B */
+  int messages_delivered;  /* messages delivered to layer 5 */
+};
+
+/* open the sample file and write the column header, returns 0 on failure */
+extern int sampler_open(const char *filename);
+
+/* append one sample to the sample file */
+extern void sampler_write(const struct sample *s);
+
+/* flush any buffered samples and close the sample file */
+extern void sampler_close(void);
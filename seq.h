@@ -0,0 +1,23 @@
+/* Sequence numbers are 32 bit serial numbers (RFC 1982).  They count up  */
+/* from 0 with no modulus and wrap round at 2^32, and two of them compare */
+/* correctly as long as they are less than 2^31 apart, which is far more  */
+/* than any window.  The packets of a window are kept in a ring of a      */
+/* power of 2 slots, at least the window size, with sequence number s in  */
+/* slot s & (slots-1), so no separate slot indexes have to be kept.       */
+#include <stdint.h>
+
+typedef uint32_t seq_t;
+
+/* how far sequence number b is ahead of a, negative if it is behind */
+#define SEQ_DIFF(b, a)    ((int32_t)((seq_t)(b) - (seq_t)(a)))
+
+/* serial number order */
+#define SEQ_LT(a, b)      (SEQ_DIFF(b, a) > 0)
+#define SEQ_LEQ(a, b)     (SEQ_DIFF(b, a) >= 0)
+
+/* s is one of the count sequence numbers starting at first, in one compare */
+#define SEQ_INWINDOW(s, first, count) \
+  ((seq_t)((seq_t)(s) - (seq_t)(first)) < (seq_t)(count))
+
+/* ring slot of sequence number s, slots must be a power of 2 */
+#define SEQ_SLOT(s, slots) ((seq_t)(s) & (seq_t)((slots) - 1))
@@ -3,6 +3,7 @@
 #include <stdbool.h>
 #include "emulator.h"
 #include "sr.h"
+#include "seq.h"
 
 /* ******************************************************************
     Selected Repeat (SR) protocol.  Adapted from J.F.Kurose
@@ -20,6 +21,8 @@
     - removed bidirectional GBN code and other code not used by prac.
     - fixed C style to adhere to current programming style
     - added SR implementation
+    - sequence numbers are 32 bit serial numbers (see seq.h) instead of
+      counting modulo a small sequence space
 **********************************************************************/
 
 /* Key differences from Go-Back-N:
@@ -27,16 +30,32 @@
       not everything after it.
     - The receiver can buffer out-of-order packets and wait for the missing ones.
     - Each packet gets its own ACK, instead of cumulative ACKs.
-    - Needs a bigger sequence number space (at least 2 × window size).
+    - Needs a bigger sequence number space (at least 2 × window size), which
+      32 bit serial numbers give with room to spare.
 */
 
+/* the protocol constants can be fixed by the build, e.g. -DWINDOWSIZE=12 -DRINGSIZE=16 */
+#ifndef RTT
 #define RTT  16.0       /* round trip time.  MUST BE SET TO 16.0 when submitting assignment */
+#endif
+#ifndef WINDOWSIZE
 #define WINDOWSIZE 6    /* the maximum number of buffered unacked packet
                           MUST BE SET TO 6 when submitting assignment */
-                        /* still missing messages, test with adjust this*/ 
-#define SEQSPACE 12      /* this one is different from GBN, should be time windowsize with 2*/
+#endif
+#ifndef RINGSIZE
+#define RINGSIZE 8      /* window slots, a power of 2 not below WINDOWSIZE */
+#endif
 #define NOTINUSE (-1)   /* used to fill header fields that are not being used */
 
+#if (RINGSIZE & (RINGSIZE - 1)) != 0 || RINGSIZE < WINDOWSIZE
+#error RINGSIZE must be a power of 2 and at least WINDOWSIZE
+#endif
+
+#ifndef PACKETTIMERS
+#define PACKETTIMERS 0  /* 1 gives every packet in the window its own timer
+                           from the timer service instead of one for A */
+#endif
+
 /* generic procedure to compute the checksum of a packet.  Used by both sender and receiver
     the simulator will overwrite part of your packet with 'z's.  It will not overwrite your
     original checksum.  This procedure must generate a different checksum to the original  if
@@ -45,15 +64,15 @@
 
 int ComputeChecksum(struct pkt packet)
 {
-  int checksum = 0;
+  unsigned checksum = 0;  /* sequence numbers use all 32 bits, so the sum wraps */
   int i;
 
-  checksum = packet.seqnum;
-  checksum += packet.acknum;
+  checksum = (unsigned)packet.seqnum;
+  checksum += (unsigned)packet.acknum;
   for ( i=0; i<20; i++ )
-    checksum += (int)(packet.payload[i]);
+    checksum += (unsigned)(packet.payload[i]);
 
-  return checksum;
+  return (int)checksum;
 }
 
 bool IsCorrupted(struct pkt packet)
@@ -68,17 +87,23 @@ bool IsCorrupted(struct pkt packet)
 /********* Sender (A) variables and functions ************/
 /* */
 
-static struct pkt buffer[WINDOWSIZE];  /* array for storing packets waiting for ACK */
-static int windowfirst, windowlast;    /* array indexes of the first/last packet awaiting ACK */
+static struct pkt buffer[RINGSIZE];    /* packets waiting for ACK, in the slot of their seqnum */
+static seq_t windowfirst;              /* sequence number of the first packet awaiting ACK */
 static int windowcount;                /* the number of packets currently awaiting an ACK */
-static int A_nextseqnum;               /* the next sequence number to be used by the sender */
-static bool acked_pkt[WINDOWSIZE];          /* same length with window size, result like [0,1,1,0...]*/
+static seq_t A_nextseqnum;             /* the next sequence number to be used by the sender */
+static bool acked_pkt[RINGSIZE];       /* which slots of the window are ACKed */
+#if PACKETTIMERS
+static struct timer pkttimer[RINGSIZE];     /* retransmission timer of each buffer slot */
+
+static void A_packettimeout(int AorB, void *cookie);
+#endif
 
 /* successfully test, this one doesn't need adjusted*/
 /* called from layer 5 (application layer), passed the message to be sent to other side */
 void A_output(struct msg message)
 {
   struct pkt sendpkt;
+  int slot;
   int i;
 
   /* if not blocked waiting on ACK */
@@ -94,9 +119,8 @@ void A_output(struct msg message)
     sendpkt.checksum = ComputeChecksum(sendpkt);
 
     /* put packet in window buffer */
-    /* windowlast will always be 0 for alternating bit; but not for GoBackN */
-    windowlast = (windowlast + 1) % WINDOWSIZE;
-    buffer[windowlast] = sendpkt;
+    slot = SEQ_SLOT(A_nextseqnum, RINGSIZE);
+    buffer[slot] = sendpkt;
     windowcount++;
 
     /* send out packet */
@@ -104,12 +128,16 @@ void A_output(struct msg message)
       printf("Sending packet %d to layer 3\n", sendpkt.seqnum);
     tolayer3 (A, sendpkt);
 
+#if PACKETTIMERS
+    settimer(&pkttimer[slot], A, RTT, A_packettimeout, &buffer[slot]);
+#else
     /* start timer if first packet in window */
     if (windowcount == 1)
       starttimer(A,RTT);
+#endif
 
-    /* get next sequence number, wrap back to 0 */
-    A_nextseqnum = (A_nextseqnum + 1) % SEQSPACE;
+    /* get next sequence number */
+    A_nextseqnum++;
   }
   /* if blocked,  window is full */
   else {
@@ -131,32 +159,36 @@ void A_input(struct pkt packet)
   if (!IsCorrupted(packet)) {
     if (TRACE > 0)
       printf("----A: uncorrupted ACK %d is received\n", packet.acknum);
-    if (!acked_pkt[packet.acknum]) {
+    /* only ACKs for a packet in the window are new, anything else is a duplicate */
+    if (SEQ_INWINDOW(packet.acknum, windowfirst, windowcount) &&
+        !acked_pkt[SEQ_SLOT(packet.acknum, RINGSIZE)]) {
       int packets_to_remove = 0; 
       int i;
       if (TRACE > 0)
       printf("----A: ACK %d is not a duplicate\n", packet.acknum);
       new_ACKs++;
-      acked_pkt[packet.acknum] = true;
+      acked_pkt[SEQ_SLOT(packet.acknum, RINGSIZE)] = true;
+#if PACKETTIMERS
+      canceltimer(&pkttimer[SEQ_SLOT(packet.acknum, RINGSIZE)]);
+#endif
   
       /*check the acked_pkt from windowfirst*/
       
-      for (i = 0; i < windowcount; i++) {
-        int current_index = (windowfirst + i) % WINDOWSIZE;
-        if (acked_pkt[buffer[current_index].seqnum]) {
-          packets_to_remove++;
-        } else {
-          break;
-        }
-      }
+      while (packets_to_remove < windowcount &&
+             acked_pkt[SEQ_SLOT(windowfirst + packets_to_remove, RINGSIZE)])
+        packets_to_remove++;
   
       /* window slide, update windowfirst and windowcount numbers */
       if (packets_to_remove > 0) {
-        windowfirst = (windowfirst + packets_to_remove) % WINDOWSIZE;
+        for (i = 0; i < packets_to_remove; i++)
+          acked_pkt[SEQ_SLOT(windowfirst + i, RINGSIZE)] = false;
+        windowfirst += packets_to_remove;
         windowcount -= packets_to_remove;
+#if !PACKETTIMERS
         stoptimer(A);
         if (windowcount > 0)
           starttimer(A, RTT);
+#endif
       }
     }
     else if (TRACE > 0)
@@ -174,38 +206,95 @@ void A_timerinterrupt(void)
     printf("----A: time out,resend packets!\n");
 
   if (TRACE > 0)
-    printf ("---A: resending packet %d\n", buffer[(windowfirst)].seqnum);
+    printf ("---A: resending packet %d\n", buffer[SEQ_SLOT(windowfirst, RINGSIZE)].seqnum);
 
-  tolayer3(A,buffer[(windowfirst)]);
+  tolayer3(A,buffer[SEQ_SLOT(windowfirst, RINGSIZE)]);
   packets_resent++;
   if (windowcount != 0)
     starttimer(A,RTT);
 }
 
+#if PACKETTIMERS
+/* called when the timer of one packet goes off, cookie is the packet.  With
+   a timer per packet the whole window can time out together, and resending
+   it every RTT swamps the channel, so resent packets wait twice as long */
+static void A_packettimeout(int AorB, void *cookie)
+{
+  struct pkt *packet = cookie;
+
+  if (TRACE > 0)
+    printf ("---A: time out, resending packet %d\n", packet->seqnum);
+
+  tolayer3(AorB, *packet);
+  packets_resent++;
+  settimer(&pkttimer[packet - buffer], AorB, 2 * RTT, A_packettimeout, packet);
+}
+#endif
+
 
 /* the following routine will be called once (only) before any other */
 /* entity A routines are called. You can use it to do any initialization */
 /* just migrate from GBN*/
 void A_init(void)
 {
+  int i;
+
   A_nextseqnum = 0;
   windowfirst = 0;
-  windowlast = -1;
   windowcount = 0;
+  for (i = 0; i < RINGSIZE; i++)
+    acked_pkt[i] = false;
+#if PACKETTIMERS
+  for (i = 0; i < RINGSIZE; i++)
+    canceltimer(&pkttimer[i]);
+#endif
+}
+
+/* number of packets in A's window still awaiting an ACK */
+int A_windowcount(void)
+{
+  return windowcount;
 }
 
 /********* Receiver (B)  variables and procedures ************/
 
-static int expectedseqnum; /* the sequence number expected next by the receiver */
-static int B_nextseqnum;   /* the sequence number for the next packets sent by B */
-static bool received[SEQSPACE]; /* track the received pkts*/
-static struct pkt received_pkts[SEQSPACE]; /* buffer for storing pkts*/
+static seq_t expectedseqnum; /* the sequence number expected next by the receiver */
+static int B_nextseqnum;     /* the sequence number for the next packets sent by B */
+static bool received[RINGSIZE];      /* which ring slots hold a packet not yet delivered */
+static struct msg rcvring[RINGSIZE]; /* receive ring buffer, in the slot of the seqnum */
+
+/* deliver the run of buffered packets starting at expectedseqnum straight
+   from the ring slots.  A run that wraps past the end of the ring is handed
+   to layer 5 as two batches. */
+static void B_deliverrun(void)
+{
+  int first = SEQ_SLOT(expectedseqnum, RINGSIZE);
+  int count = 0;
+  int i;
+
+  while (count < WINDOWSIZE && received[SEQ_SLOT(first + count, RINGSIZE)])
+    count++;
+  if (count == 0)
+    return;
+
+  for (i = 0; i < count; i++)
+    received[SEQ_SLOT(first + i, RINGSIZE)] = false; /* free the slots */
+
+  if (first + count <= RINGSIZE)
+    tolayer5_batch(B, &rcvring[first], count);
+  else {
+    tolayer5_batch(B, &rcvring[first], RINGSIZE - first);
+    tolayer5_batch(B, &rcvring[0], first + count - RINGSIZE);
+  }
+  expectedseqnum += count;
+}
 
 /* called from layer 3, when a packet arrives for layer 4 at B*/
 /* got a buffer for the loss pkt and store*/
 void B_input(struct pkt packet)
 {
   struct pkt sendpkt;
+  int offset;
   int i;
 
   if  (!IsCorrupted(packet)) {
@@ -213,18 +302,23 @@ void B_input(struct pkt packet)
       printf("----B: packet %d is correctly received, send ACK!\n",packet.seqnum);
     packets_received++;
 
-    /* deliver to receiving application but check the receiving status of pkt first*/
-    if (received[packet.seqnum] == false) {
-      received[packet.seqnum] = true; /* if not received before then change the status*/
+    /* position of the packet in the receive window, packets outside it
+       were already delivered and only need to be ACKed again */
+    offset = SEQ_DIFF(packet.seqnum, expectedseqnum);
+    if (offset == 0) {
+      /* in order: deliver directly from the packet, then any buffered run behind it */
+      tolayer5(B, packet.payload);
+      expectedseqnum++;
+      B_deliverrun();
+    }
+    else if (offset > 0 && offset < WINDOWSIZE &&
+             !received[SEQ_SLOT(packet.seqnum, RINGSIZE)]) {
+      /* out of order: hold it in its ring slot until the gap is filled */
+      received[SEQ_SLOT(packet.seqnum, RINGSIZE)] = true;
       for (i = 0; i < 20; i++)
-        received_pkts[packet.seqnum].payload[i] = packet.payload[i]; /* struct the pkt to the pre-defined buffer */
+        rcvring[SEQ_SLOT(packet.seqnum, RINGSIZE)].data[i] = packet.payload[i];
     }
 
-    while (received[expectedseqnum] == true) {
-      tolayer5(B, packet.payload);
-      received[expectedseqnum] = false; /* empty the space by updating the status to false*/
-      expectedseqnum = (expectedseqnum + 1) % SEQSPACE; /* plus 1 and proceed the while check for true status*/
-    }
     /*update sendpkt bits*/
     sendpkt.acknum = packet.seqnum;
     sendpkt.seqnum = NOTINUSE;
@@ -241,8 +335,89 @@ void B_input(struct pkt packet)
 /* entity B routines are called. You can use it to do any initialization */
 void B_init(void)
 {
+  int i;
+
   expectedseqnum = 0;
   B_nextseqnum = 1;
+  for (i = 0; i < RINGSIZE; i++)
+    received[i] = false;
+}
+
+/* number of out of order packets held in B's receive buffer */
+int B_buffercount(void)
+{
+  int count = 0;
+  int i;
+
+  for (i = 0; i < RINGSIZE; i++)
+    if (received[i])
+      count++;
+  return count;
+}
+
+/******************************************************************************
+ * Snapshot support: the whole protocol state, in a fixed order              *
+ *****************************************************************************/
+
+#define SAVE(x) (fwrite(&(x), sizeof(x), 1, fp) == 1)
+#define LOAD(x) (fread(&(x), sizeof(x), 1, fp) == 1)
+
+int save_protocol(FILE *fp)
+{
+#if PACKETTIMERS
+  /* the timers are saved as the time each has left, negative if stopped */
+  double remaining[RINGSIZE];
+  int i;
+
+  for (i = 0; i < RINGSIZE; i++)
+    remaining[i] = timerremaining(&pkttimer[i]);
+  if (!SAVE(remaining))
+    return 0;
+#endif
+  return SAVE(buffer) && SAVE(windowfirst) && SAVE(windowcount)
+    && SAVE(A_nextseqnum) && SAVE(expectedseqnum) && SAVE(B_nextseqnum)
+    && SAVE(acked_pkt) && SAVE(received) && SAVE(rcvring);
+}
+
+int restore_protocol(FILE *fp)
+{
+#if PACKETTIMERS
+  double remaining[RINGSIZE];
+  int i;
+
+  if (!LOAD(remaining))
+    return 0;
+  for (i = 0; i < RINGSIZE; i++) {
+    canceltimer(&pkttimer[i]);
+    if (remaining[i] >= 0.0)
+      settimer(&pkttimer[i], A, remaining[i], A_packettimeout, &buffer[i]);
+  }
+#endif
+  return LOAD(buffer) && LOAD(windowfirst) && LOAD(windowcount)
+    && LOAD(A_nextseqnum) && LOAD(expectedseqnum) && LOAD(B_nextseqnum)
+    && LOAD(acked_pkt) && LOAD(received) && LOAD(rcvring);
+}
+
+/* the protocol and its build options, which a snapshot must match */
+const char *protocol_config(void)
+{
+  static char config[96];
+
+  sprintf(config, "sr packettimers=%d window=%d ring=%d rtt=%g",
+          PACKETTIMERS, WINDOWSIZE, RINGSIZE, RTT);
+  return config;
+}
+
+/* bytes of state save_protocol writes */
+long protocol_statesize(void)
+{
+  return sizeof(buffer) + sizeof(windowfirst) + sizeof(windowcount)
+    + sizeof(A_nextseqnum) + sizeof(expectedseqnum) + sizeof(B_nextseqnum)
+    + sizeof(acked_pkt) + sizeof(received) + sizeof(rcvring)
+#if PACKETTIMERS
+    + RINGSIZE * sizeof(double)
+#endif
+    ;
 }
 
 /******************************************************************************
@@ -5,6 +5,19 @@ extern void B_input(struct pkt);
 extern void A_output(struct msg);
 extern void A_timerinterrupt(void);
 
+/* window and receive buffer occupancy, reported by the metrics sampler */
+extern int A_windowcount(void);
+extern int B_buffercount(void);
+
+/* write and read back all protocol state for simulation snapshots, 0 on failure */
+extern int save_protocol(FILE *);
+extern int restore_protocol(FILE *);
+
+/* the protocol and its build options, and the bytes of state save_protocol
+   writes, recorded in snapshots so only the same build restores them */
+extern const char *protocol_config(void);
+extern long protocol_statesize(void);
+
 /* included for extension to bidirectional communication */
 #define BIDIRECTIONAL 0       /*  0 = A->B  1 =  A<->B */
 extern void B_output(struct msg);
@@ -0,0 +1,160 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include "emulator.h"
+#include "timer.h"
+
+/* ******************************************************************
+   Hierarchical timing wheel.
+
+   Time is cut into ticks of TIMERTICK.  Level 0 has one slot for each
+   of the next WHEELSLOTS ticks and every level above it has slots
+   WHEELSLOTS times as wide.  A timer is linked into the slot of the
+   lowest level that reaches its expiry, so arming and cancelling a
+   timer touch one list and cost the same however many are running.
+   Each time a level wraps round, the next slot of the level above is
+   emptied into the levels below it.
+
+   Timers keep their exact expiry, and the ones due in the same tick go
+   off in order of expiry, so the tick only sets how far the wheel
+   turns at a time and not when timers go off.
+**********************************************************************/
+
+#define TIMERTICK   0.25                /* simulated time covered by a level 0 slot */
+#define WHEELBITS   6
+#define WHEELSLOTS  (1 << WHEELBITS)    /* slots in each level */
+#define WHEELMASK   (WHEELSLOTS - 1)
+#define WHEELLEVELS 4                   /* the wheel reaches WHEELSLOTS^4 ticks ahead */
+#define WHEELREACH  (1L << (WHEELLEVELS * WHEELBITS))
+
+static struct timer *wheel[WHEELLEVELS][WHEELSLOTS]; /* unordered list of timers per slot */
+static long wheeltick;     /* tick the wheel has turned to, never past the simulated time */
+static int ntimers;        /* number of timers armed */
+
+static long tickof(double t)
+{
+  return (long)(t / TIMERTICK);
+}
+
+/* link t into the slot that covers its expiry */
+static void place(struct timer *t)
+{
+  struct timer **head;
+  long tick = tickof(t->expiry);
+  int level;
+
+  if (tick < wheeltick)
+    tick = wheeltick;                /* overdue, goes off in the current tick */
+  else if (tick - wheeltick >= WHEELREACH)
+    tick = wheeltick + WHEELREACH - 1; /* out of reach, placed again on the way down */
+  for (level=0; level<WHEELLEVELS-1; level++)
+    if (tick - wheeltick < 1L << ((level+1) * WHEELBITS))
+      break;
+
+  head = &wheel[level][(tick >> (level * WHEELBITS)) & WHEELMASK];
+  t->slot = head;
+  t->prev = NULL;
+  t->next = *head;
+  if (*head != NULL)
+    (*head)->prev = t;
+  *head = t;
+}
+
+/* unlink t from its slot */
+static void takeout(struct timer *t)
+{
+  if (t->prev != NULL)
+    t->prev->next = t->next;
+  else
+    *t->slot = t->next;
+  if (t->next != NULL)
+    t->next->prev = t->prev;
+  t->slot = NULL;
+  t->prev = NULL;
+  t->next = NULL;
+}
+
+/* move the timers of the current slot of level down to the levels below */
+static void cascade(int level)
+{
+  struct timer *t, *list;
+  int index = (wheeltick >> (level * WHEELBITS)) & WHEELMASK;
+
+  list = wheel[level][index];
+  wheel[level][index] = NULL;
+  while (list != NULL) {
+    t = list;
+    list = list->next;
+    place(t);
+  }
+}
+
+/* turn the wheel forward one tick */
+static void turn(void)
+{
+  int level;
+
+  wheeltick++;
+  for (level=1; level<WHEELLEVELS; level++) {
+    if ((wheeltick & ((1L << (level * WHEELBITS)) - 1)) != 0)
+      break;
+    cascade(level);
+  }
+}
+
+void timer_reset(double now)
+{
+  struct timer *t;
+  int level, index;
+
+  for (level=0; level<WHEELLEVELS; level++)
+    for (index=0; index<WHEELSLOTS; index++)
+      while ((t = wheel[level][index]) != NULL)
+        takeout(t);
+  ntimers = 0;
+  wheeltick = tickof(now);
+}
+
+void timer_arm(struct timer *t, double expiry)
+{
+  if (t->slot != NULL)
+    takeout(t);
+  else
+    ntimers++;
+  t->expiry = expiry;
+  place(t);
+}
+
+void timer_disarm(struct timer *t)
+{
+  if (t->slot != NULL) {
+    takeout(t);
+    ntimers--;
+  }
+}
+
+struct timer *timer_due(double limit)
+{
+  struct timer *t, *first;
+
+  if (ntimers == 0) {
+    /* an empty wheel can jump straight to the limit */
+    if (limit / TIMERTICK < WHEELREACH * (double)WHEELREACH && tickof(limit) > wheeltick)
+      wheeltick = tickof(limit);
+    return NULL;
+  }
+  for (;;) {
+    /* level 0's current slot only holds timers due in the current tick */
+    first = NULL;
+    for (t = wheel[0][wheeltick & WHEELMASK]; t != NULL; t = t->next)
+      if (t->expiry <= limit && (first == NULL || t->expiry <= first->expiry))
+        first = t;
+    if (first != NULL || (wheeltick + 1) * TIMERTICK > limit)
+      return first;
+    turn();
+  }
+}
+
+int timer_count(void)
+{
+  return ntimers;
+}
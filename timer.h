@@ -0,0 +1,19 @@
+/* timing wheel behind settimer() and canceltimer().  Times are absolute */
+/* simulated times; the emulator converts the student's increments.    */
+
+/* disarm every timer and start the wheel again at time now */
+extern void timer_reset(double now);
+
+/* arm t to go off at time expiry, rearming it if it is already running */
+extern void timer_arm(struct timer *t, double expiry);
+
+/* disarm t, nothing happens if it is not running */
+extern void timer_disarm(struct timer *t);
+
+/* the earliest timer due at or before limit, which is left armed, or NULL
+   if none is.  Turns the wheel forward, so limit must never be earlier
+   than the simulated time. */
+extern struct timer *timer_due(double limit);
+
+/* number of timers armed */
+extern int timer_count(void);
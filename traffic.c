@@ -0,0 +1,228 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <float.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "emulator.h"
+#include "traffic.h"
+
+/* ******************************************************************
+   Traffic generators for the messages arriving from layer 5.
+
+   All processes have a mean gap of lambda between arrivals, except
+   the trace which replays absolute arrival times.  A trace file holds
+   one time per line, in non-decreasing order, and lines starting
+   with '#' are comments.  The file is memory mapped and checked line
+   by line when it is opened, so a bad line stops the run before it
+   starts, and then parsed one line per arrival, so traces of any
+   length are streamed without being read into memory.
+**********************************************************************/
+
+#define ONOFF_BURST 10.0   /* mean number of messages in an ON burst */
+#define ONOFF_PEAK  5.0    /* rate during a burst, as a multiple of 1/lambda */
+#define TRACELINE   128    /* longest line of a trace file */
+
+static const char *processnames[] = { "uniform", "poisson", "onoff", "cbr", "trace" };
+
+static int burstleft;              /* messages left in the current ON burst */
+
+static const char *tracedata = NULL; /* the mapped trace file */
+static const char *tracename;        /* its file name, for messages */
+static size_t tracesize;             /* length of the mapped trace file */
+static size_t tracepos;              /* offset of the next unread line */
+
+/* exponentially distributed value with the given mean */
+static double exponential(double mean)
+{
+  double u = jimsrand();
+
+  if (u >= 1.0)
+    u = 0.999999;
+  return -mean * log(1.0 - u);
+}
+
+/* parse the trace line starting at *pp and step *pp past it.  Returns 1
+   with its time in *value, 0 for a blank or comment line, or -1 if the
+   line is not a single number */
+static int parseline(const char **pp, double *value)
+{
+  const char *p = *pp, *end = tracedata + tracesize, *eol;
+  char line[TRACELINE], *start, *rest;
+  size_t n;
+
+  eol = memchr(p, '\n', end - p);
+  if (eol == NULL)
+    eol = end;
+  *pp = eol < end ? eol + 1 : end;
+  n = eol - p;
+  if (n >= TRACELINE)
+    return -1;
+  memcpy(line, p, n);
+  line[n] = '\0';
+
+  for (start = line; isspace((unsigned char)*start); start++)
+    ;
+  if (*start == '\0' || *start == '#')
+    return 0;
+  *value = strtod(start, &rest);
+  if (rest == start || !(*value >= -DBL_MAX && *value <= DBL_MAX))
+    return -1;         /* no number, or not a finite one */
+  while (isspace((unsigned char)*rest))
+    rest++;
+  return *rest == '\0' ? 1 : -1;
+}
+
+/* check every line of the trace, reporting the first bad one */
+static int checktrace(void)
+{
+  const char *p = tracedata, *end = tracedata + tracesize;
+  double value, last = 0.0;
+  int line, kind;
+
+  for (line = 1; p < end; line++) {
+    kind = parseline(&p, &value);
+    if (kind < 0) {
+      printf("arrival trace %s line %d: not a time\n", tracename, line);
+      return 0;
+    }
+    if (kind > 0 && value < 0.0) {
+      printf("arrival trace %s line %d: negative time %g\n", tracename, line, value);
+      return 0;
+    }
+    if (kind > 0 && value < last) {
+      printf("arrival trace %s line %d: time %g is before the time %g above it\n",
+             tracename, line, value, last);
+      return 0;
+    }
+    if (kind > 0)
+      last = value;
+  }
+  return 1;
+}
+
+/* parse the next arrival time from the trace, negative at the end */
+static double nexttracetime(void)
+{
+  const char *p = tracedata + tracepos, *end = tracedata + tracesize;
+  double value;
+
+  while (p < end)
+    if (parseline(&p, &value) > 0) {
+      tracepos = p - tracedata;
+      return value;
+    }
+  tracepos = tracesize;
+  return -1.0;
+}
+
+int traffic_process(const char *name)
+{
+  int i;
+
+  for (i=0; i<(int)(sizeof(processnames)/sizeof(processnames[0])); i++)
+    if (strcmp(name, processnames[i]) == 0)
+      return i;
+  return -1;
+}
+
+int traffic_opentrace(const char *filename)
+{
+  struct stat st;
+  void *data;
+  int fd;
+
+  fd = open(filename, O_RDONLY);
+  if (fd < 0 || fstat(fd, &st) < 0) {
+    printf("unable to open arrival trace %s\n", filename);
+    if (fd >= 0)
+      close(fd);
+    return 0;
+  }
+  tracesize = st.st_size;
+  tracepos = 0;
+  if (tracesize == 0) {
+    close(fd);
+    tracedata = "";
+    return 1;
+  }
+  data = mmap(NULL, tracesize, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    printf("unable to map arrival trace %s\n", filename);
+    return 0;
+  }
+  madvise(data, tracesize, MADV_SEQUENTIAL);
+  tracedata = data;
+  tracename = filename;
+  if (!checktrace()) {
+    traffic_close();
+    return 0;
+  }
+  return 1;
+}
+
+void traffic_reset(void)
+{
+  burstleft = 0;
+  tracepos = 0;
+}
+
+double traffic_next(int process, double lambda, double now)
+{
+  double t;
+
+  switch (process) {
+  case ARRIVAL_POISSON:
+    return now + exponential(lambda);
+  case ARRIVAL_ONOFF:
+    /* bursts of a geometric number of messages ONOFF_PEAK times faster than
+       lambda, with idle periods that bring the mean gap back to lambda */
+    if (burstleft > 0) {
+      burstleft--;
+      return now + lambda / ONOFF_PEAK;
+    }
+    burstleft = (int)exponential(ONOFF_BURST - 0.5); /* rounding down loses 0.5 */
+    return now + lambda / ONOFF_PEAK
+      + exponential(ONOFF_BURST * lambda * (1.0 - 1.0 / ONOFF_PEAK));
+  case ARRIVAL_CBR:
+    return now + lambda;
+  case ARRIVAL_TRACE:
+    if (tracedata == NULL)
+      return -1.0;
+    t = nexttracetime();
+    if (t >= 0.0 && t < now)
+      t = now;           /* never schedule into the past */
+    return t;
+  default:
+    return now + lambda*jimsrand()*2;  /* uniform on [0,2*lambda], mean lambda */
+  }
+}
+
+#define SAVE(x) (fwrite(&(x), sizeof(x), 1, fp) == 1)
+#define LOAD(x) (fread(&(x), sizeof(x), 1, fp) == 1)
+
+int traffic_save(FILE *fp)
+{
+  return SAVE(burstleft) && SAVE(tracepos);
+}
+
+int traffic_restore(FILE *fp)
+{
+  if (!(LOAD(burstleft) && LOAD(tracepos)))
+    return 0;
+  if (tracepos > tracesize)
+    tracepos = tracesize;
+  return 1;
+}
+
+void traffic_close(void)
+{
+  if (tracedata != NULL && tracesize > 0)
+    munmap((void *)tracedata, tracesize);
+  tracedata = NULL;
+}
@@ -0,0 +1,25 @@
+/* arrival processes for the messages passed from layer 5 to layer 4 */
+#define ARRIVAL_UNIFORM 0   /* gaps uniform on [0,2*lambda], the original generator */
+#define ARRIVAL_POISSON 1   /* exponential gaps with mean lambda */
+#define ARRIVAL_ONOFF   2   /* bursts separated by idle periods, mean gap lambda */
+#define ARRIVAL_CBR     3   /* one message every lambda, saturates the sender */
+#define ARRIVAL_TRACE   4   /* arrival times replayed from a trace file */
+
+/* arrival process named name, -1 if there is no such process */
+extern int traffic_process(const char *name);
+
+/* map the trace file of arrival times, returns 0 on failure */
+extern int traffic_opentrace(const char *filename);
+
+/* start the generators again from the beginning */
+extern void traffic_reset(void);
+
+/* time of the arrival after the one at now, negative once a trace has ended */
+extern double traffic_next(int process, double lambda, double now);
+
+/* write and read back the generator state for simulation snapshots, 0 on failure */
+extern int traffic_save(FILE *fp);
+extern int traffic_restore(FILE *fp);
+
+/* unmap the trace file, if any */
+extern void traffic_close(void);
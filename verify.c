@@ -0,0 +1,235 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include "emulator.h"
+#include "verify.h"
+
+/* ******************************************************************
+   Delivery verifier.
+
+   The last IDCHARS bytes of each generated message are overwritten
+   with its id, written in printable characters so traces stay
+   readable.  The messages A accepts are numbered in the order it
+   accepted them, and a sliding window of VWINDOW of those numbers
+   holds the id and hash of each and a bitmap of the ones already
+   delivered.  abase is the oldest accepted message still waiting for
+   delivery, which in order delivery must hand over next.  Messages A
+   drops take no room in the window, so a sender that drops most of
+   what it is offered is checked just as well as one that drops none.
+   The window only gives up on a message when VWINDOW newer ones have
+   been accepted, which no protocol window comes near; a message
+   delivered after that counts as a duplicate.  Only a few words are
+   touched per message, so the check is cheap enough to leave enabled
+   in benchmark runs.
+**********************************************************************/
+
+#define IDCHARS  4                    /* trailing message bytes holding the id */
+#define IDBITS   (6 * IDCHARS)        /* each id character carries 6 bits */
+#define IDMASK   ((1 << IDBITS) - 1)
+#define VWINDOW  4096                 /* accepted messages tracked, must be a power of 2 */
+#define VMASK    (VWINDOW - 1)
+
+#define TESTBIT(map, n)  (((map)[((n) & VMASK) >> 5] >> ((n) & 31)) & 1)
+#define SETBIT(map, n)   ((map)[((n) & VMASK) >> 5] |= (uint32_t)1 << ((n) & 31))
+#define CLEARBIT(map, n) ((map)[((n) & VMASK) >> 5] &= ~((uint32_t)1 << ((n) & 31)))
+
+static const char idalphabet[] =
+  "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz+/";
+static signed char idvalue[256];       /* reverse of idalphabet, -1 if invalid */
+
+static int ids[VWINDOW];               /* id of each tracked accepted message */
+static uint32_t hashes[VWINDOW];       /* hash of each of them */
+static uint32_t delivered[VWINDOW/32]; /* the ones already delivered at B */
+static int abase;                      /* oldest accepted message not yet delivered */
+static int naccepted;                  /* messages A has accepted so far */
+static int ndecided;                   /* ids A has accepted or dropped so far */
+static uint32_t newhash;               /* hash of the message A is deciding on */
+
+/* verification results */
+static int nverified;      /* messages delivered in order exactly once */
+static int nreordered;     /* messages delivered ahead of an older one */
+static int nduplicated;    /* messages delivered more than once */
+static int ncorrupted;     /* messages whose content does not match */
+static int nunknown;       /* deliveries that match no generated message */
+static int nmissing;       /* accepted messages never delivered */
+
+/* FNV-1a hash of a message */
+static uint32_t hashmsg(const char data[20])
+{
+  uint32_t h = 2166136261u;
+  int i;
+
+  for (i=0; i<20; i++) {
+    h ^= (unsigned char)data[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+/* slide the window past messages which have been delivered */
+static void advance(void)
+{
+  while (abase < naccepted && TESTBIT(delivered, abase))
+    abase++;
+}
+
+/* the accepted message with the given id, -1 if A never accepted it.
+   Ids rise with acceptance order, so the window is searched by halves */
+static int findaccepted(int id)
+{
+  int low = abase, high = naccepted - 1, mid;
+
+  while (low <= high) {
+    mid = low + (high - low) / 2;
+    if (ids[mid & VMASK] == id)
+      return mid;
+    if (ids[mid & VMASK] < id)
+      low = mid + 1;
+    else
+      high = mid - 1;
+  }
+  return -1;
+}
+
+/* build idvalue from idalphabet */
+static void buildidvalue(void)
+{
+  int i;
+
+  for (i=0; i<256; i++)
+    idvalue[i] = -1;
+  for (i=0; i<64; i++)
+    idvalue[(unsigned char)idalphabet[i]] = i;
+}
+
+void verify_init(void)
+{
+  buildidvalue();
+  abase = 0;
+  naccepted = 0;
+  ndecided = 0;
+  nverified = 0;
+  nreordered = 0;
+  nduplicated = 0;
+  ncorrupted = 0;
+  nunknown = 0;
+  nmissing = 0;
+}
+
+void verify_generate(struct msg *message, int id)
+{
+  int i;
+
+  for (i=0; i<IDCHARS; i++)
+    message->data[20-IDCHARS+i] = idalphabet[(id >> (6*i)) & 63];
+  newhash = hashmsg(message->data);
+}
+
+void verify_accepted(int id, int isaccepted)
+{
+  ndecided = id + 1;
+  if (!isaccepted)
+    return;
+
+  /* the window is full of messages the protocol never delivered: give up on them */
+  while (naccepted - abase >= VWINDOW) {
+    if (!TESTBIT(delivered, abase))
+      nmissing++;
+    abase++;
+  }
+  ids[naccepted & VMASK] = id;
+  hashes[naccepted & VMASK] = newhash;
+  CLEARBIT(delivered, naccepted);
+  naccepted++;
+}
+
+void verify_delivered(const char data[20])
+{
+  int stamp = 0;
+  int id, v, i, n, near;
+
+  for (i=0; i<IDCHARS; i++) {
+    v = idvalue[(unsigned char)data[20-IDCHARS+i]];
+    if (v < 0) {
+      nunknown++;
+      return;
+    }
+    stamp |= v << (6*i);
+  }
+
+  /* the stamp only holds the low IDBITS bits, take the id nearest the
+     oldest message waiting, or the newest if none is */
+  near = abase < naccepted ? ids[abase & VMASK] : ndecided;
+  id = (stamp - near) & IDMASK;
+  if (id & (1 << (IDBITS-1)))
+    id -= 1 << IDBITS;
+  id += near;
+
+  if (id < near && id >= 0) {
+    nduplicated++;
+    return;
+  }
+  n = findaccepted(id);
+  if (n < 0) {
+    nunknown++;
+    return;
+  }
+  if (TESTBIT(delivered, n)) {
+    nduplicated++;
+    return;
+  }
+  if (hashmsg(data) != hashes[n & VMASK])
+    ncorrupted++;
+  if (n != abase)
+    nreordered++;
+  else
+    nverified++;
+  SETBIT(delivered, n);
+  advance();
+}
+
+int verify_errors(void)
+{
+  return nreordered + nduplicated + ncorrupted + nunknown;
+}
+
+#define SAVE(x) (fwrite(&(x), sizeof(x), 1, fp) == 1)
+#define LOAD(x) (fread(&(x), sizeof(x), 1, fp) == 1)
+
+int verify_save(FILE *fp)
+{
+  return SAVE(ids) && SAVE(hashes) && SAVE(delivered) && SAVE(abase)
+    && SAVE(naccepted) && SAVE(ndecided) && SAVE(newhash) && SAVE(nverified)
+    && SAVE(nreordered) && SAVE(nduplicated) && SAVE(ncorrupted) && SAVE(nunknown)
+    && SAVE(nmissing);
+}
+
+int verify_restore(FILE *fp)
+{
+  buildidvalue();
+  return LOAD(ids) && LOAD(hashes) && LOAD(delivered) && LOAD(abase)
+    && LOAD(naccepted) && LOAD(ndecided) && LOAD(newhash) && LOAD(nverified)
+    && LOAD(nreordered) && LOAD(nduplicated) && LOAD(ncorrupted) && LOAD(nunknown)
+    && LOAD(nmissing);
+}
+
+int verify_missing(void)
+{
+  int missing = nmissing;
+  int n;
+
+  for (n = abase; n < naccepted; n++)
+    if (!TESTBIT(delivered, n))
+      missing++;
+  return missing;
+}
+
+void verify_report(void)
+{
+  printf("verifier: messages delivered in order exactly once:  %d \n", nverified);
+  printf("verifier: messages delivered out of order:  %d \n", nreordered);
+  printf("verifier: duplicate deliveries:  %d \n", nduplicated);
+  printf("verifier: deliveries with corrupted content:  %d \n", ncorrupted);
+  printf("verifier: deliveries of unknown messages:  %d \n", nunknown);
+  printf("verifier: accepted messages never delivered:  %d \n", verify_missing());
+}
@@ -0,0 +1,28 @@
+/* Delivery verifier.  Every message generated at A is stamped with a   */
+/* sequence id and its hash is recorded, so that each delivery at B can */
+/* be checked for order, duplication and content.                      */
+
+/* reset the verifier before the first message is generated */
+extern void verify_init(void);
+
+/* stamp message with id and record its hash */
+extern void verify_generate(struct msg *message, int id);
+
+/* tell the verifier whether A accepted message id or dropped it */
+extern void verify_accepted(int id, int accepted);
+
+/* check one message delivered to layer 5 at B */
+extern void verify_delivered(const char data[20]);
+
+/* number of deliveries that failed a check so far */
+extern int verify_errors(void);
+
+/* number of accepted messages not delivered so far */
+extern int verify_missing(void);
+
+/* write and read back the verifier state for simulation snapshots, 0 on failure */
+extern int verify_save(FILE *fp);
+extern int verify_restore(FILE *fp);
+
+/* print the verification results */
+extern void verify_report(void);